@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include "batch.h"
+
+/* Lockstep execution: every cycle each lane fetches its instruction and
+ * neighbouring lanes sharing the same instruction are executed together
+ * by one loop over the lanes. Lanes running the same program usually
+ * share the instruction, so these loops run over the whole batch and
+ * vectorize; lanes that diverged get runs of length 1.		*/
+
+// increment program counter (same bounds as Chip8::incrementPC)
+static inline unsigned short advance(const unsigned short& pc, const int& n)
+{
+	return pc <= 0xFFF - n ? pc + n : pc;
+}
+
+// stop the lane - pc is left at the failing instruction
+static inline void halt(Batch::Machines& m, const int& lane)
+{
+	m.pc[lane] = m.address[lane];
+	m.halted[lane] = 1;
+}
+
+/* stop lanes [first, last) on instruction that can't be decoded (lanes
+ * already halted or idle in the run didn't fetch it)		*/
+static void invalid(Batch::Machines& m, const int& first, const int& last)
+{
+	for (int l = first; l < last; ++l)
+		if (!m.stopped[l]) halt(m, l);
+}
+
+/* idle loop detection (same as Idle::check) - compare lane state with
+ * the one saved at its last backward jump. If nothing but pc moved since
+ * then, the lane can't make progress before the end of the frame	*/
+static void check(Batch::Machines& m, const int& lane, const unsigned short& target)
+{
+	unsigned char* saved_registers = &m.saved_registers[lane * 16];
+	unsigned short* saved_stack = &m.saved_stack[lane * 16];
+
+	bool same = !m.dirty[lane] && target == m.saved_target[lane]
+		&& m.I[lane] == m.saved_I[lane] && m.sc[lane] == m.saved_sc[lane];
+	for (int i = 0; same && i < 16; ++i)
+		same = m.registers[i][lane] == saved_registers[i]
+			&& m.stack[i][lane] == saved_stack[i];
+
+	if (same) {
+		m.idle[lane] = 1;
+		m.dirty[lane] = 1;
+		return;
+	}
+
+	// save current state
+	m.saved_target[lane] = target;
+	m.saved_I[lane] = m.I[lane];
+	m.saved_sc[lane] = m.sc[lane];
+	for (int i = 0; i < 16; ++i) {
+		saved_registers[i] = m.registers[i][lane];
+		saved_stack[i] = m.stack[i][lane];
+	}
+	m.dirty[lane] = 0;
+}
+
+// create lanes running the same program
+void Batch::init(Machines& m, const int& lanes, const std::string& f, const uint32_t& seed)
+{
+	std::ifstream ifs {f,std::ios_base::binary};
+
+	if(!ifs) {
+		throw std::runtime_error("Error: can't open file " + f + '\n');
+	}
+
+	// program is loaded to memory adress 0x200 to 0xEAO
+	std::vector<char> program(0xEA0 - 0x200, 0);
+	ifs.read(program.data(), program.size());
+
+	m.lanes = lanes;
+	for (auto& r : m.registers) r.assign(lanes, 0);
+	for (auto& s : m.stack) s.assign(lanes, 0);
+	m.I.assign(lanes, 0);
+	m.pc.assign(lanes, 0x200);
+	m.delay_timer.assign(lanes, 0);
+	m.sound_timer.assign(lanes, 0);
+	m.sc.assign(lanes, 0);
+	m.keys.assign(lanes, 0);
+	m.released.assign(lanes, 0);
+	m.waiting.assign(lanes, 0);
+	m.rng.assign(lanes, 0);
+	m.halted.assign(lanes, 0);
+	m.instr.assign(lanes, 0);
+	m.address.assign(lanes, 0x200);
+	m.stopped.assign(lanes, 0);
+	m.idle.assign(lanes, 0);
+	m.dirty.assign(lanes, 1);
+	m.saved_target.assign(lanes, 0);
+	m.saved_I.assign(lanes, 0);
+	m.saved_sc.assign(lanes, 0);
+	m.saved_registers.assign(lanes * 16, 0);
+	m.saved_stack.assign(lanes * 16, 0);
+	m.memory.assign(lanes * 4096, 0);
+	m.display.assign(lanes * 2048, 0);
+
+	for (int l = 0; l < lanes; ++l) {
+		unsigned char* memory = &m.memory[l * 4096];
+		std::copy(font, font + 90, memory);
+		std::copy(program.begin(), program.end(), memory + 0x200);
+
+		// xorshift state can't be 0
+		m.rng[l] = seed + l ? seed + l : 1;
+	}
+}
+
+/* execute instruction on lanes [first, last) - stopped lanes in the range
+ * are left unchanged (plain assignments select the old value instead of
+ * branching, so the loops still vectorize)			*/
+static void execute(Batch::Machines& m, const unsigned short& instr, const int& first, const int& last)
+{
+	unsigned char* VX = m.registers[SECOND_NIBBLE(instr)].data();
+	unsigned char* VY = m.registers[THIRD_NIBBLE(instr)].data();
+	unsigned char* VF = m.registers[0xF].data();
+	unsigned short* pc = m.pc.data();
+	const unsigned char* stopped = m.stopped.data();
+	unsigned char* dirty = m.dirty.data();
+	const unsigned char nn = NN(instr,0);
+	const unsigned short nnn = NNN(instr);
+
+	switch(FIRST_NIBBLE(instr)) {
+	case 0x0:
+		switch(instr) {
+		// 00EE - return from subroutine
+		case 0x00EE:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				if (!m.sc[l]) {
+					halt(m, l);
+					continue;
+				}
+				pc[l] = m.stack[m.sc[l]-1][l];
+				m.stack[m.sc[l]-1][l] = 0;
+				--m.sc[l];
+			}
+			break;
+		// 00E0 - Clear screen
+		case 0x00E0:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				std::fill(&m.display[l * 2048], &m.display[0] + (l + 1) * 2048, 0);
+				dirty[l] = 1;
+			}
+			break;
+		// 0NNN - machine code routines are ignored (like Chip8::decodeAndExecute)
+		default:
+			break;
+		}
+		break;
+	// 1NNN - Jump
+	case 0x1:
+		for (int l = first; l < last; ++l) {
+			if (stopped[l]) continue;
+			// jumping backwards (or to itself) may close an idle loop
+			if (nnn <= m.address[l]) check(m, l, nnn);
+			pc[l] = nnn;
+		}
+		break;
+	// 2NNN - call subroutine
+	case 0x2:
+		for (int l = first; l < last; ++l) {
+			if (stopped[l]) continue;
+			if (m.sc[l] == 16) {
+				halt(m, l);
+				continue;
+			}
+			m.stack[m.sc[l]][l] = pc[l];
+			pc[l] = nnn;
+			++m.sc[l];
+		}
+		break;
+	// 3XNN - skip one instruction if VX is equal to NN
+	case 0x3:
+		for (int l = first; l < last; ++l)
+			if (!stopped[l] && VX[l] == nn) pc[l] = advance(pc[l], 2);
+		break;
+	// 4XNN - skip one instruction if VX is not equal to NN
+	case 0x4:
+		for (int l = first; l < last; ++l)
+			if (!stopped[l] && VX[l] != nn) pc[l] = advance(pc[l], 2);
+		break;
+	// 5XY0 - skip one instruction if VX == VY
+	case 0x5:
+		if (FOURTH_NIBBLE(instr)) {
+			invalid(m, first, last);
+			break;
+		}
+		for (int l = first; l < last; ++l)
+			if (!stopped[l] && VX[l] == VY[l]) pc[l] = advance(pc[l], 2);
+		break;
+	// 6XNN - Set register VX value to NN
+	case 0x6:
+		for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : nn;
+		break;
+	//7XNN - Add NN to register VX value
+	case 0x7:
+		for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : VX[l] + nn;
+		break;
+	/* 8XYN - same order of operations as Chip8::decodeAndExecute, so
+	 * VF and X == Y cases give the same results		*/
+	case 0x8:
+		switch (FOURTH_NIBBLE(instr)) {
+		case 0x0:
+			for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : VY[l];
+			break;
+		case 0x1:
+			for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : VX[l] | VY[l];
+			break;
+		case 0x2:
+			for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : VX[l] & VY[l];
+			break;
+		case 0x3:
+			for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : VX[l] ^ VY[l];
+			break;
+		case 0x4:
+			for (int l = first; l < last; ++l) {
+				unsigned short sum = VX[l] + VY[l];
+				VX[l] = stopped[l] ? VX[l] : sum;
+				VF[l] = stopped[l] ? VF[l] : sum > 0xFF;
+			}
+			break;
+		case 0x5:
+			for (int l = first; l < last; ++l) {
+				bool underflow = VX[l] < VY[l];
+				VX[l] = stopped[l] ? VX[l] : VX[l] - VY[l];
+				VF[l] = stopped[l] ? VF[l] : !underflow;
+			}
+			break;
+		case 0x6:
+			for (int l = first; l < last; ++l) {
+				VX[l] = stopped[l] ? VX[l] : VY[l] >> 1;
+				VF[l] = stopped[l] ? VF[l] : VY[l] & 0b00000001;
+			}
+			break;
+		case 0x7:
+			for (int l = first; l < last; ++l) {
+				bool underflow = VY[l] < VX[l];
+				VX[l] = stopped[l] ? VX[l] : VY[l] - VX[l];
+				VF[l] = stopped[l] ? VF[l] : !underflow;
+			}
+			break;
+		case 0xE:
+			for (int l = first; l < last; ++l) {
+				VX[l] = stopped[l] ? VX[l] : VY[l] << 1;
+				VF[l] = stopped[l] ? VF[l] : (VY[l] & 0b10000000) >> 7;
+			}
+			break;
+		default:
+			invalid(m, first, last);
+		}
+		break;
+	// 9XY0 - skip one instruction if VX != VY
+	case 0x9:
+		if (FOURTH_NIBBLE(instr)) {
+			invalid(m, first, last);
+			break;
+		}
+		for (int l = first; l < last; ++l)
+			if (!stopped[l] && VX[l] != VY[l]) pc[l] = advance(pc[l], 2);
+		break;
+	// ANNN - Set index(address register) to NNN
+	case 0xA:
+		for (int l = first; l < last; ++l) m.I[l] = stopped[l] ? m.I[l] : nnn;
+		break;
+	// BNNN - Jump with offset
+	case 0xB:
+		for (int l = first; l < last; ++l)
+			if (!stopped[l]) pc[l] = advance(nnn, m.registers[0x0][l]);
+		break;
+	// CXNN - random number (xorshift32 per lane) AND NN
+	case 0xC:
+		for (int l = first; l < last; ++l) {
+			if (stopped[l]) continue;
+			uint32_t x = m.rng[l];
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			m.rng[l] = x;
+			VX[l] = (x % 0xFF) & nn;
+			dirty[l] = 1;
+		}
+		break;
+	// DXYN - Display sprite
+	case 0xD:
+		for (int l = first; l < last; ++l) {
+			if (stopped[l]) continue;
+			bool collision = Display::blit(&m.display[l * 2048],
+				&m.memory[l * 4096], m.I[l], VX[l], VY[l], FOURTH_NIBBLE(instr));
+			VF[l] = collision;
+			dirty[l] = 1;
+		}
+		break;
+	case 0xE:
+		switch (nn) {
+		// EX9E - skip one instruction if the key in VX is pressed
+		case 0x9E:
+			for (int l = first; l < last; ++l)
+				if (!stopped[l] && m.keys[l] & (1 << (VX[l] & 0xF)))
+					pc[l] = advance(pc[l], 2);
+			break;
+		// EXA1 - skip one instruction if the key in VX is not pressed
+		case 0xA1:
+			for (int l = first; l < last; ++l)
+				if (!stopped[l] && !(m.keys[l] & (1 << (VX[l] & 0xF))))
+					pc[l] = advance(pc[l], 2);
+			break;
+		default:
+			invalid(m, first, last);
+		}
+		break;
+	case 0xF:
+		switch (nn) {
+		// FX07 - set VX to the current value of the delay timer
+		case 0x07:
+			for (int l = first; l < last; ++l) VX[l] = stopped[l] ? VX[l] : m.delay_timer[l];
+			break;
+		// FX15 - set the delay timer to the value in VX
+		case 0x15:
+			for (int l = first; l < last; ++l) {
+				m.delay_timer[l] = stopped[l] ? m.delay_timer[l] : VX[l];
+				dirty[l] |= !stopped[l];
+			}
+			break;
+		// FX18 - set the sound timer to the value in VX
+		case 0x18:
+			for (int l = first; l < last; ++l) {
+				m.sound_timer[l] = stopped[l] ? m.sound_timer[l] : VX[l];
+				dirty[l] |= !stopped[l];
+			}
+			break;
+		// FX1E - add to index (VF set to 1 if I overflows)
+		case 0x1E:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				if (m.I[l] + VX[l] > 0xFFF) VF[l] = 1;
+				m.I[l] += VX[l];
+			}
+			break;
+		// FX0A - get key (repeated until a key is released)
+		case 0x0A:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				if (!m.waiting[l]) {
+					m.waiting[l] = 1;
+					m.released[l] = 0;
+				}
+
+				if (m.released[l]) {
+					int key = 0;
+					while (!(m.released[l] & (1 << key))) ++key;
+
+					VX[l] = key;
+					m.waiting[l] = 0;
+					m.released[l] = 0;
+				} else {
+					pc[l] -= 2;
+					check(m, l, pc[l]);
+				}
+			}
+			break;
+		// FX29 - font character
+		case 0x29:
+			for (int l = first; l < last; ++l) m.I[l] = stopped[l] ? m.I[l] : VX[l] * 5;
+			break;
+		// FX33 - binary-coded decimal conversion
+		case 0x33:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				unsigned char* memory = &m.memory[l * 4096];
+				unsigned char value = VX[l];
+				memory[m.I[l] & 0xFFF] = value / 100;
+				memory[(m.I[l] + 1) & 0xFFF] = (value % 100) / 10;
+				memory[(m.I[l] + 2) & 0xFFF] = value % 10;
+				dirty[l] = 1;
+			}
+			break;
+		// FX55 - store registers V0 - VX values in memory
+		case 0x55:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				unsigned char* memory = &m.memory[l * 4096];
+				for (int i = 0; i <= SECOND_NIBBLE(instr); ++i)
+					memory[(m.I[l] + i) & 0xFFF] = m.registers[i][l];
+				m.I[l] += SECOND_NIBBLE(instr) + 1;
+				dirty[l] = 1;
+			}
+			break;
+		// FX65 - load values from memory to registers
+		case 0x65:
+			for (int l = first; l < last; ++l) {
+				if (stopped[l]) continue;
+				const unsigned char* memory = &m.memory[l * 4096];
+				for (int i = 0; i <= SECOND_NIBBLE(instr); ++i)
+					m.registers[i][l] = memory[(m.I[l] + i) & 0xFFF];
+				m.I[l] += SECOND_NIBBLE(instr) + 1;
+			}
+			break;
+		default:
+			invalid(m, first, last);
+		}
+		break;
+	}
+}
+
+// fetch and execute one instruction on every lane
+void Batch::cycle(Machines& m)
+{
+	// fetch instruction of every lane that isn't halted or idle
+	for (int l = 0; l < m.lanes; ++l) {
+		m.stopped[l] = m.halted[l] | m.idle[l];
+		if (m.stopped[l]) continue;
+		const unsigned char* memory = &m.memory[l * 4096];
+		m.address[l] = m.pc[l];
+		m.instr[l] = (memory[m.pc[l]] << 8) | memory[(m.pc[l] + 1) & 0xFFF];
+		m.pc[l] = advance(m.pc[l], 2);
+	}
+
+	/* execute runs of neighbouring lanes sharing the same instruction
+	 * (stopped lanes don't end a run, execute leaves them unchanged)	*/
+	for (int first = 0; first < m.lanes;) {
+		if (m.stopped[first]) {
+			++first;
+			continue;
+		}
+
+		int last = first + 1;
+		while (last < m.lanes && (m.stopped[last] || m.instr[last] == m.instr[first])) ++last;
+
+		execute(m, m.instr[first], first, last);
+		first = last;
+	}
+}
+
+// run one frame on every lane
+void Batch::step(Machines& m, const std::vector<unsigned short>& actions,
+	const int& instructions, std::vector<float>& rewards)
+{
+	/* set pressed keys, remember released ones for FX0A (keys and
+	 * timers changed, idle loops have to be detected again)	*/
+	for (int l = 0; l < m.lanes; ++l) {
+		m.released[l] |= m.keys[l] & ~actions[l];
+		m.keys[l] = actions[l];
+		m.dirty[l] = 1;
+	}
+
+	/* lanes spinning in an idle loop sleep until the end of the frame,
+	 * the frame ends early when all lanes are halted or idle	*/
+	for (int n = 0; n < instructions; ++n) {
+		Batch::cycle(m);
+		if (std::count(m.stopped.begin(), m.stopped.end(), 0) == 0) break;
+	}
+
+	// timers tick once per frame (60Hz)
+	for (int l = 0; l < m.lanes; ++l) {
+		m.delay_timer[l] -= m.delay_timer[l] > 0;
+		m.sound_timer[l] -= m.sound_timer[l] > 0;
+		m.idle[l] = 0;
+	}
+
+	rewards.assign(m.lanes, 0.0f);
+	if (m.reward)
+		for (int l = 0; l < m.lanes; ++l) rewards[l] = m.reward(m, l);
+}
@@ -0,0 +1,98 @@
+/* Batch engine - many CHIP-8 machines stepped in lockstep for search and
+ * reinforcement learning workloads. The header doesn't depend on SDL, the
+ * engine is built on its own as libchip8batch.a (make batch).	*/
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// macros for extracting nibbles from 4 digit hex numbers
+#define FIRST_NIBBLE(instr) (instr >> 12)
+#define SECOND_NIBBLE(instr) ((instr & 0x0F00) >> 8)
+#define THIRD_NIBBLE(instr) ((instr & 0x00F0) >> 4)
+#define FOURTH_NIBBLE(instr) (instr & 0x000F)
+#define NNN(instr) (instr & 0x0FFF)
+#define NN(instr, n) ((instr >> n) & 0x00FF)
+
+// calculate pixel buffer index based on coordinates
+#define PIXEL_INDEX(X, x_offset, Y, y_offset) (X+x_offset+(Y+y_offset)*64)
+
+// font
+extern unsigned char font[90];
+
+namespace Display {
+	/* draw sprite of given number of rows, read from memory at given
+	 * address (wrapping at 4kb), into the pixel buffer; return collision */
+	bool blit(unsigned char* buffer, const unsigned char* memory,
+		const unsigned short& address, unsigned char X, unsigned char Y,
+		const int& rows);
+}
+
+namespace Batch {
+	struct Machines;
+	// reward function - called for every lane at the end of each step
+	using Reward = float (*)(const Machines&, int lane);
+
+	/* many machines stepped in lockstep, stored as struct of arrays
+	 * (element [lane] of every array belongs to one machine)	*/
+	struct Machines {
+		int lanes = 0;
+		// data registers (registers[x][lane]), address register, program counter
+		std::vector<unsigned char> registers[16];
+		std::vector<unsigned short> I;
+		std::vector<unsigned short> pc;
+		// timer registers
+		std::vector<unsigned char> delay_timer;
+		std::vector<unsigned char> sound_timer;
+		// stack (stack[depth][lane]) and stack counter
+		std::vector<unsigned short> stack[16];
+		std::vector<unsigned char> sc;
+		/* pressed keys (bit per CHIP-8 key), keys released since the
+		 * last FX0A started waiting and FX0A waiting flags	*/
+		std::vector<unsigned short> keys;
+		std::vector<unsigned short> released;
+		std::vector<unsigned char> waiting;
+		// random number generator state (CXNN)
+		std::vector<uint32_t> rng;
+		/* lanes stopped by an invalid instruction or a stack error
+		 * (pc stays at the failing instruction, nothing is executed)	*/
+		std::vector<unsigned char> halted;
+		// 4kb of memory and pixel buffer of every lane (lane after lane)
+		std::vector<unsigned char> memory;
+		std::vector<unsigned char> display;
+		// instruction fetched by every lane in the current cycle and its address
+		std::vector<unsigned short> instr;
+		std::vector<unsigned short> address;
+		/* idle loop detection - lanes sleeping until the end of the frame,
+		 * lanes halted or idle in the current cycle, flags set by
+		 * instructions changing state outside of the registers and
+		 * state saved at the last backward jump (16 entries per lane
+		 * for registers and stack)				*/
+		std::vector<unsigned char> idle;
+		std::vector<unsigned char> stopped;
+		std::vector<unsigned char> dirty;
+		std::vector<unsigned short> saved_target;
+		std::vector<unsigned short> saved_I;
+		std::vector<unsigned char> saved_sc;
+		std::vector<unsigned char> saved_registers;
+		std::vector<unsigned short> saved_stack;
+		// optional reward function
+		Reward reward = nullptr;
+	};
+
+	// create lanes running the same program (random generators seeded with seed + lane)
+	void init(Machines&, const int& lanes, const std::string& f, const uint32_t& seed);
+	/* fetch and execute one instruction on every lane that isn't halted
+	 * or idle (timers aren't ticked, idle flags aren't cleared)	*/
+	void cycle(Machines&);
+	/* run one frame - set keys from actions (key mask per lane), execute
+	 * up to the given number of instructions (lanes caught in an idle
+	 * loop stop early), tick timers and fill rewards.
+	 * Framebuffers of all lanes are in Machines::display		*/
+	void step(Machines&, const std::vector<unsigned short>& actions,
+		const int& instructions, std::vector<float>& rewards);
+}
+
+#endif
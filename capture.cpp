@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "capture.h"
+
+/* framebuffer packed to 1 bit per pixel (8 bytes per row, most
+ * significant bit is the leftmost pixel)			*/
+using Frame = std::array<unsigned char, 256>;
+
+// output formats (chosen by file extension)
+enum class Format { Y4M, GIF, PNG };
+
+/* single producer (emulation loop) - single consumer (encoder thread)
+ * ring buffer. Pushing never waits - frames are dropped when it's full */
+constexpr unsigned queue_size = 256;
+
+// encoder thread, its queue and the state of the file being written
+struct Capture::Encoder {
+	Format format;
+	std::string output;
+	std::ofstream ofs;
+
+	Frame queue[queue_size];
+	std::atomic<unsigned> head {0};
+	std::atomic<unsigned> tail {0};
+
+	std::atomic<bool> running {false};
+	std::thread worker;
+	// frames dropped because the encoder couldn't keep up
+	std::atomic<unsigned long> dropped {0};
+
+	// Y4M - stream header written
+	bool y4m_started = false;
+
+	// GIF state - frame on screen, frame waiting for its duration, timing
+	Frame gif_shown;
+	Frame gif_pending;
+	bool gif_started = false;
+	unsigned long gif_pending_frames = 0;
+	unsigned long gif_frames = 0;
+	unsigned long gif_centiseconds = 0;
+	// LZW dictionary - code of string + pixel (0 if not present)
+	unsigned short dict[4096][2];
+
+	// PNG - previous frame and number of frames pushed
+	Frame png_previous;
+	unsigned long png_number = 0;
+};
+
+using Capture::Encoder;
+
+// read pixel from packed frame
+static bool pixel(const Frame& frame, int x, int y)
+{
+	return (frame[y * 8 + x / 8] >> (7 - x % 8)) & 1;
+}
+
+// YUV4MPEG2 - raw 4:2:0 frames (every presented frame is written)
+static void writeY4M(Encoder& e, const Frame& frame)
+{
+	if (!e.y4m_started) {
+		e.ofs << "YUV4MPEG2 W64 H32 F60:1 Ip A1:1 C420jpeg\n";
+		e.y4m_started = true;
+	}
+
+	char planes[2048 + 512 + 512];
+	for (int i = 0; i < 2048; ++i)
+		planes[i] = pixel(frame, i % 64, i / 64) ? 235 : 16;
+	// chroma planes (grayscale)
+	for (int i = 2048; i < 3072; ++i) planes[i] = char(128);
+
+	e.ofs << "FRAME\n";
+	e.ofs.write(planes, sizeof(planes));
+}
+
+// GIF - write bits to the data sub-blocks (least significant bit first)
+struct BitWriter {
+	std::vector<unsigned char> bytes;
+	unsigned int bits = 0;
+	int count = 0;
+
+	void put(int code, int size)
+	{
+		bits |= code << count;
+		count += size;
+		while (count >= 8) {
+			bytes.push_back(bits & 0xFF);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	void flush()
+	{
+		if (count) bytes.push_back(bits & 0xFF);
+		bits = 0;
+		count = 0;
+	}
+};
+
+// GIF - LZW compress pixels (minimum code size 2) and write the sub-blocks
+static void writeLZW(Encoder& e, const std::vector<unsigned char>& pixels)
+{
+	constexpr int clear = 4;
+	constexpr int end = 5;
+
+	auto& dict = e.dict;
+	int next = end + 1;
+	int size = 3;
+
+	BitWriter out;
+	out.put(clear, size);
+	std::fill(&dict[0][0], &dict[0][0] + 4096 * 2, 0);
+
+	int current = pixels[0];
+	for (std::size_t i = 1; i < pixels.size(); ++i) {
+		int p = pixels[i];
+		if (dict[current][p]) {
+			current = dict[current][p];
+			continue;
+		}
+
+		out.put(current, size);
+
+		if (next < 4095) {
+			dict[current][p] = next++;
+			if (next > (1 << size)) ++size;
+		} else {
+			// dictionary full - start over
+			out.put(clear, size);
+			std::fill(&dict[0][0], &dict[0][0] + 4096 * 2, 0);
+			next = end + 1;
+			size = 3;
+		}
+		current = p;
+	}
+	out.put(current, size);
+	out.put(end, size);
+	out.flush();
+
+	e.ofs.put(2);
+	for (std::size_t i = 0; i < out.bytes.size(); i += 255) {
+		std::size_t n = std::min<std::size_t>(255, out.bytes.size() - i);
+		e.ofs.put(char(n));
+		e.ofs.write(reinterpret_cast<const char*>(&out.bytes[i]), n);
+	}
+	e.ofs.put(0);
+}
+
+static void writeShort(std::ofstream& ofs, int value)
+{
+	ofs.put(value & 0xFF);
+	ofs.put(value >> 8);
+}
+
+/* GIF - write pending frame. Only the rectangle that changed since the
+ * previous frame is encoded, the rest of the image is kept on screen */
+static void writeGIFPending(Encoder& e, bool first)
+{
+	int left = 0, top = 0, right = 63, bottom = 31;
+
+	if (!first) {
+		left = 64; top = 32; right = -1; bottom = -1;
+		for (int y = 0; y < 32; ++y)
+			for (int x = 0; x < 64; ++x)
+				if (pixel(e.gif_pending, x, y) != pixel(e.gif_shown, x, y)) {
+					left = std::min(left, x);
+					right = std::max(right, x);
+					top = std::min(top, y);
+					bottom = std::max(bottom, y);
+				}
+	}
+
+	// frame duration (GIF delays are in 1/100 s; less than 2 is ignored by viewers)
+	e.gif_frames += e.gif_pending_frames;
+	unsigned long end = (e.gif_frames * 100 + 30) / 60;
+	unsigned long delay = end > e.gif_centiseconds + 2 ? end - e.gif_centiseconds : 2;
+	e.gif_centiseconds += delay;
+
+	// graphic control extension (disposal - leave the frame in place)
+	e.ofs.put(0x21); e.ofs.put(0xF9); e.ofs.put(4);
+	e.ofs.put(0x04);
+	writeShort(e.ofs, std::min<unsigned long>(delay, 0xFFFF));
+	e.ofs.put(0); e.ofs.put(0);
+
+	// image descriptor
+	e.ofs.put(0x2C);
+	writeShort(e.ofs, left); writeShort(e.ofs, top);
+	writeShort(e.ofs, right - left + 1); writeShort(e.ofs, bottom - top + 1);
+	e.ofs.put(0);
+
+	std::vector<unsigned char> pixels;
+	for (int y = top; y <= bottom; ++y)
+		for (int x = left; x <= right; ++x)
+			pixels.push_back(pixel(e.gif_pending, x, y));
+	writeLZW(e, pixels);
+
+	e.gif_shown = e.gif_pending;
+}
+
+// GIF - animated, identical frames extend the duration of the previous one
+static void writeGIF(Encoder& e, const Frame& frame)
+{
+	if (!e.gif_started) {
+		// header, logical screen descriptor and 2 colour global palette
+		e.ofs.write("GIF89a", 6);
+		writeShort(e.ofs, 64); writeShort(e.ofs, 32);
+		e.ofs.put(char(0x80)); e.ofs.put(0); e.ofs.put(0);
+		e.ofs.put(0); e.ofs.put(0); e.ofs.put(0);
+		e.ofs.put(char(0xFF)); e.ofs.put(char(0xFF)); e.ofs.put(char(0xFF));
+
+		// loop forever
+		e.ofs.put(0x21); e.ofs.put(char(0xFF)); e.ofs.put(11);
+		e.ofs.write("NETSCAPE2.0", 11);
+		e.ofs.put(3); e.ofs.put(1); writeShort(e.ofs, 0); e.ofs.put(0);
+
+		e.gif_pending = frame;
+		e.gif_pending_frames = 1;
+		e.gif_started = true;
+		return;
+	}
+
+	if (frame == e.gif_pending) {
+		++e.gif_pending_frames;
+		return;
+	}
+
+	writeGIFPending(e, e.gif_frames == 0);
+	e.gif_pending = frame;
+	e.gif_pending_frames = 1;
+}
+
+// GIF - write the last frame and the trailer
+static void finishGIF(Encoder& e)
+{
+	if (!e.gif_started) return;
+	writeGIFPending(e, e.gif_frames == 0);
+	e.ofs.put(0x3B);
+}
+
+// PNG - CRC-32 of chunk type and data
+static unsigned long crc32(const unsigned char* data, std::size_t size, unsigned long crc)
+{
+	// table shared by the encoder threads (initialized once)
+	static const std::array<unsigned long, 256> table = [] {
+		std::array<unsigned long, 256> t;
+		for (unsigned long n = 0; n < 256; ++n) {
+			unsigned long c = n;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+			t[n] = c;
+		}
+		return t;
+	}();
+	for (std::size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void writeChunk(std::ofstream& png, const char* type, const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> chunk(type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+
+	unsigned long size = data.size();
+	unsigned long crc = crc32(chunk.data(), chunk.size(), 0xFFFFFFFFUL) ^ 0xFFFFFFFFUL;
+	unsigned char be[4];
+
+	for (int i = 0; i < 4; ++i) be[i] = size >> (24 - 8 * i);
+	png.write(reinterpret_cast<char*>(be), 4);
+	png.write(reinterpret_cast<char*>(chunk.data()), chunk.size());
+	for (int i = 0; i < 4; ++i) be[i] = crc >> (24 - 8 * i);
+	png.write(reinterpret_cast<char*>(be), 4);
+}
+
+/* PNG sequence - 1 bit grayscale images named after the frame number.
+ * Only frames that differ from the previous one are written	*/
+static void writePNG(Encoder& e, const Frame& frame)
+{
+	if (e.png_number++ && frame == e.png_previous) return;
+	e.png_previous = frame;
+
+	// out.png -> out_000042.png
+	std::string name = e.output.substr(0, e.output.size() - 4);
+	std::string digits = std::to_string(e.png_number - 1);
+	name += '_' + std::string(digits.size() < 6 ? 6 - digits.size() : 0, '0')
+		+ digits + ".png";
+
+	std::ofstream png {name, std::ios_base::binary};
+	if (!png) return;
+	png.write("\x89PNG\r\n\x1A\n", 8);
+
+	// 64x32, bit depth 1, grayscale
+	writeChunk(png, "IHDR", { 0, 0, 0, 64, 0, 0, 0, 32, 1, 0, 0, 0, 0 });
+
+	// rows (filter type 0) - the packed frame is already PNG's layout
+	std::vector<unsigned char> raw;
+	for (int y = 0; y < 32; ++y) {
+		raw.push_back(0);
+		raw.insert(raw.end(), &frame[y * 8], &frame[y * 8] + 8);
+	}
+
+	// zlib stream with a single stored block (the image is 288 bytes)
+	unsigned long a = 1, b = 0;
+	for (unsigned char c : raw) {
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	std::vector<unsigned char> data = { 0x78, 0x01, 1,
+		static_cast<unsigned char>(raw.size() & 0xFF),
+		static_cast<unsigned char>(raw.size() >> 8),
+		static_cast<unsigned char>(~raw.size() & 0xFF),
+		static_cast<unsigned char>((~raw.size() >> 8) & 0xFF) };
+	data.insert(data.end(), raw.begin(), raw.end());
+	for (int i = 0; i < 4; ++i) data.push_back(((b << 16) | a) >> (24 - 8 * i));
+
+	writeChunk(png, "IDAT", data);
+	writeChunk(png, "IEND", {});
+}
+
+// encoder thread - drain the queue until capture is stopped
+static void encode(Encoder& e)
+{
+	while (e.running || e.tail != e.head) {
+		unsigned t = e.tail.load(std::memory_order_relaxed);
+		if (t == e.head.load(std::memory_order_acquire)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+
+		const Frame& frame = e.queue[t % queue_size];
+		switch (e.format) {
+		case Format::Y4M: writeY4M(e, frame); break;
+		case Format::GIF: writeGIF(e, frame); break;
+		case Format::PNG: writePNG(e, frame); break;
+		}
+
+		e.tail.store(t + 1, std::memory_order_release);
+	}
+
+	if (e.format == Format::GIF) finishGIF(e);
+	e.ofs.flush();
+}
+
+Capture::Stream::Stream() = default;
+
+Capture::Stream::~Stream()
+{
+	Capture::stop(*this);
+}
+
+// start the encoder thread writing to the file (format chosen by extension)
+void Capture::start(Stream& stream, const std::string& filename)
+{
+	auto ends_with = [&](const std::string& ext) {
+		return filename.size() > ext.size()
+			&& filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+	};
+
+	Capture::stop(stream);
+	std::unique_ptr<Encoder> e {new Encoder};
+
+	if (ends_with(".y4m")) e->format = Format::Y4M;
+	else if (ends_with(".gif")) e->format = Format::GIF;
+	else if (ends_with(".png")) e->format = Format::PNG;
+	else throw std::runtime_error("Unknown capture format: " + filename + '\n');
+
+	e->output = filename;
+	if (e->format != Format::PNG) {
+		e->ofs.open(filename, std::ios_base::binary);
+		if (!e->ofs)
+			throw std::runtime_error("Error: can't open file " + filename + '\n');
+	}
+
+	e->running = true;
+	e->worker = std::thread(encode, std::ref(*e));
+	stream.encoder = std::move(e);
+}
+
+// copy the framebuffer into the queue (never blocks)
+void Capture::push(Stream& stream, const unsigned char* buffer)
+{
+	Encoder* e = stream.encoder.get();
+	if (!e || !e->running) return;
+
+	unsigned h = e->head.load(std::memory_order_relaxed);
+	if (h - e->tail.load(std::memory_order_acquire) == queue_size) {
+		++e->dropped;
+		return;
+	}
+
+	Frame& frame = e->queue[h % queue_size];
+	for (int i = 0; i < 256; ++i) {
+		unsigned char byte = 0;
+		for (int bit = 0; bit < 8; ++bit)
+			byte = (byte << 1) | (buffer[i * 8 + bit] ? 1 : 0);
+		frame[i] = byte;
+	}
+
+	e->head.store(h + 1, std::memory_order_release);
+}
+
+// encode the remaining frames and stop the encoder thread
+void Capture::stop(Stream& stream)
+{
+	Encoder* e = stream.encoder.get();
+	if (!e || !e->running) return;
+	e->running = false;
+	e->worker.join();
+	e->ofs.close();
+}
+
+// number of frames dropped because the queue was full
+unsigned long Capture::dropped(const Stream& stream)
+{
+	return stream.encoder ? stream.encoder->dropped.load() : 0;
+}
+
+// stream of frames presented by the emulator
+static Capture::Stream presented;
+
+void Capture::start(const std::string& filename)
+{
+	Capture::start(presented, filename);
+}
+
+void Capture::push(const unsigned char* buffer)
+{
+	Capture::push(presented, buffer);
+}
+
+void Capture::stop()
+{
+	Capture::stop(presented);
+
+	if (Capture::dropped(presented))
+		std::cerr << "Capture: dropped " << Capture::dropped(presented) << " frames\n";
+}
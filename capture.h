@@ -0,0 +1,39 @@
+/* Recording of pixel buffers to Y4M, GIF or PNG files. Frames are packed
+ * into a queue and encoded by a background thread, so pushing never
+ * waits. The header doesn't depend on SDL: batch engine users can keep
+ * a stream per lane, e.g. Capture::push(stream[l], &m.display[l * 2048]) */
+#ifndef CHIP8_CAPTURE_H
+#define CHIP8_CAPTURE_H
+
+#include <memory>
+#include <string>
+
+namespace Capture {
+	// encoder thread and its queue (defined in capture.cpp)
+	struct Encoder;
+
+	// recording of one pixel buffer to one file
+	struct Stream {
+		Stream();
+		// stops the encoder thread if it's still running
+		~Stream();
+		std::unique_ptr<Encoder> encoder;
+	};
+
+	// start the encoder thread writing to the file (format chosen by extension)
+	void start(Stream&, const std::string& filename);
+	// copy the 64x32 pixel buffer into the encoder queue (never blocks)
+	void push(Stream&, const unsigned char* buffer);
+	// encode the remaining frames and stop the encoder thread
+	void stop(Stream&);
+	// number of frames dropped because the queue was full
+	unsigned long dropped(const Stream&);
+
+	// stream of frames presented by the emulator (-c option)
+	void start(const std::string& filename);
+	void push(const unsigned char* buffer);
+	// stop the stream, report dropped frames
+	void stop();
+}
+
+#endif
@@ -19,26 +19,36 @@ unsigned char* stack[16];
 // stack counter
 unsigned char sc = 0;
 
-// font
-unsigned char font[90] ={ 0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
-		          0x20, 0x60, 0x20, 0x20, 0x70,   // 1
-		          0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2
-			  0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
-			  0x90, 0x90, 0xF0, 0x10, 0x10,   // 4
-			  0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
-			  0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
-			  0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
-			  0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
-			  0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
-			  0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
-			  0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
-			  0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
-			  0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
-			  0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
-			  0xF0, 0x80, 0xF0, 0x80, 0x80 }; // F
+// random number generator state
+uint32_t random_state = 1;
 
 // states of keys
 bool Keyboard::state[322];
+// CHIP-8 keys released while FX0A is waiting
+unsigned short Keyboard::released = 0;
+bool Keyboard::waiting = false;
+
+// timer ticks since start
+std::atomic<unsigned int> Chip8::ticks {0};
+
+// cycles left over by the previous frame (cycle timing)
+int Chip8::budget = 0;
+
+// program stopped on an error
+bool Chip8::halted = false;
+// address of the instruction executed last and the error that halted the program
+static unsigned char* fetched = &storage[0x200];
+static std::string halt_error;
+
+// report the error that halted the program (once)
+static void reportHalt()
+{
+	static bool reported = false;
+	if (!Chip8::halted || reported) return;
+
+	std::cerr << halt_error;
+	reported = true;
+}
 
 void Chip8::init()
 {
@@ -57,6 +67,9 @@ void Chip8::init()
 	// load font into memory
 	for (int i = 0; i < 90; ++i) storage[i] = font[i];
 
+	// seed random number generator (CXNN, xorshift state can't be 0)
+	random_state = time(NULL) | 1;
+
 	// initialize SDL with its modules
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
 		std::cout << "Error: Couldnt initialize SDL" << '\n';
@@ -92,9 +105,11 @@ void Chip8::loadFile(const std::string& f)
 
 unsigned short Chip8::instructionFetch()
 {
+	fetched = pc;
+
 	// read two bytes from memory
 	unsigned char byte_1 = *pc;
-	unsigned char byte_2 = pc[1];
+	unsigned char byte_2 = storage[(pc - storage + 1) & 0xFFF];
 
 	// increment program counter by two
 	Chip8::incrementPC(2);
@@ -110,12 +125,13 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 {
 	switch(FIRST_NIBBLE(instr)) {
 	case 0x0:
-		switch(FOURTH_NIBBLE(instr)) {
+		switch(instr) {
 		// 00EE - return from subroutine
-		case 0xE: {
-			if (!sc) 
-				throw std::runtime_error
-					("Error: decrementing empty stack\n");
+		case 0x00EE: {
+			if (!sc) {
+				Chip8::halt("decrementing empty stack");
+				break;
+			}
 			// set program counter to the last stack element
 			pc = stack[sc-1];
 			// "pop" last element of the stack
@@ -125,20 +141,30 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 			break;	
 		}
 		// 00E0 - Clear screen
-		case 0x0: {
+		case 0x00E0: {
 			for (int i = 0; i < 2048; ++i) Display::buffer[i] = 0;
+			Idle::dirty = true;
 			break;
 		}
+		/* 0NNN - machine code routines can't be executed, they're
+		 * ignored like in most interpreters		*/
+		default:
+			break;
 		}
 		break;
 	// 1NNN - Jump
 	case 0x1:
+		// jumping backwards (or to itself) may close an idle loop
+		if (&storage[NNN(instr)] <= pc - 2)
+			Idle::check(&storage[NNN(instr)]);
 		pc = &storage[NNN(instr)];
 		break;
 	// 2NNN - call subroutine
 	case 0x2:
-		if (sc == 16)
-			throw std::runtime_error("Error: stack overflow\n");
+		if (sc == 16) {
+			Chip8::halt("stack overflow");
+			break;
+		}
 		// push current program counter on to the stack 
 		stack[sc] = pc;
 		//set program counter to NNN
@@ -158,6 +184,10 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 		break;
 	// 5XY0 - skip one instruction if VX == VY
 	case 0x5:
+		if (FOURTH_NIBBLE(instr)) {
+			Chip8::invalidInstruction(instr);
+			break;
+		}
 		if (registers[SECOND_NIBBLE(instr)] == registers[THIRD_NIBBLE(instr)]) 
 			Chip8::incrementPC(2);
 		break;
@@ -258,10 +288,17 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 
 			registers[0xF] = (registers[THIRD_NIBBLE(instr)] & 0b10000000) >> 7;
 			break;
+		default:
+			Chip8::invalidInstruction(instr);
+			break;
 		}
 		break;
 	// 9XY0 - skip one instruction if VX != VY
 	case 0x9:
+		if (FOURTH_NIBBLE(instr)) {
+			Chip8::invalidInstruction(instr);
+			break;
+		}
 		if (registers[SECOND_NIBBLE(instr)] != registers[THIRD_NIBBLE(instr)])
 			Chip8::incrementPC(2);
 		break;
@@ -275,27 +312,35 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 		pc = &storage[NNN(instr)];
 		Chip8::incrementPC(registers[0x0]);
 		break;
-	// CXNN - generate random number, AND it with NN and put the result in VX
+	/* CXNN - generate random number, AND it with NN and put the result in VX
+		(xorshift - unlike std::rand() its state can be saved)	*/
 	case 0xC:
-		std::srand(time(NULL));
-		registers[SECOND_NIBBLE(instr)] = (std::rand() % 0xFF) & NN(instr,0);
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		registers[SECOND_NIBBLE(instr)] = (random_state % 0xFF) & NN(instr,0);
+		Idle::dirty = true;
 		break;
 	// DXYN - Display sprite
 	case 0xD:
 		Display::drawSprite(instr);
+		Idle::dirty = true;
 		break;
 	case 0xE:
 		switch (NN(instr,0)) {
 		// EX9E - skip one instruction if the key corresponding to value in VX is pressed
 		case 0x9E:
-			if (Keyboard::state[Keyboard::scancodes[registers[SECOND_NIBBLE(instr)]]])
+			if (Keyboard::state[Keyboard::scancodes[registers[SECOND_NIBBLE(instr)] & 0xF]])
 				Chip8::incrementPC(2);
 			break;
 		// EXA1 - skip one instruction if the key corresponding to value in VX is not pressed
 		case 0xA1:
-			if (!Keyboard::state[Keyboard::scancodes[registers[SECOND_NIBBLE(instr)]]])
+			if (!Keyboard::state[Keyboard::scancodes[registers[SECOND_NIBBLE(instr)] & 0xF]])
 				Chip8::incrementPC(2);
 			break;
+		default:
+			Chip8::invalidInstruction(instr);
+			break;
 		}
 		break;
 	case 0xF:
@@ -307,10 +352,12 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 		// FX15 - set the delay timer to the value in VX
 		case 0x15:
 			delay_timer = registers[SECOND_NIBBLE(instr)];
+			Idle::dirty = true;
 			break;
 		// FX18 - set the sound timer to the value in VX
 		case 0x18:
 			sound_timer = registers[SECOND_NIBBLE(instr)];
+			Idle::dirty = true;
 			break;
 		// FX1E - add to index(address register)
 		case 0x1E:
@@ -322,20 +369,24 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 			break;
 		// FX0A - get key (wait for input;store hexadecimal value of pressed key in VX)
 		case 0x0A: {
-			SDL_Event event;
-			bool key_released = false;
-
-			while (!key_released) {
-				while(SDL_PollEvent(&event)!=0) {
-					for (int i = 0; i < 16; ++i) {
-						if(event.key.keysym.scancode == Keyboard::scancodes[i]
-						&& event.type == SDL_KEYUP) {
-							registers[SECOND_NIBBLE(instr)] = i;
-							key_released = true;
-						}
-					}
-				}
-			}	
+			/* the instruction doesn't block the main loop - it's
+			 * repeated until one of the keys is released	*/
+			if (!Keyboard::waiting) {
+				Keyboard::waiting = true;
+				Keyboard::released = 0;
+			}
+
+			if (Keyboard::released) {
+				int key = 0;
+				while (!(Keyboard::released & (1 << key))) ++key;
+
+				registers[SECOND_NIBBLE(instr)] = key;
+				Keyboard::waiting = false;
+				Keyboard::released = 0;
+			} else {
+				pc -= 2;
+				Idle::check(pc);
+			}
 			break;
 			}
 		/* FX29 - font character 
@@ -348,30 +399,37 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 			break;
 		/* FX33 - binary-coded decimal conversion (convert the number
 		in VX to three decimal digits and store in memory starting
-			at memory location pointed to by I)		*/
+			at memory location pointed to by I)		
+		(addresses past the end of memory wrap around, as I can
+		 	grow past 0xFFF with FX1E, FX55 and FX65)	*/
 		case 0x33:
-			storage[I] = registers[SECOND_NIBBLE(instr)] / 100;
-			storage[I+1] = (registers[SECOND_NIBBLE(instr)] % 100) / 10;
-			storage[I+2] = registers[SECOND_NIBBLE(instr)] % 10;
+			storage[I & 0xFFF] = registers[SECOND_NIBBLE(instr)] / 100;
+			storage[(I+1) & 0xFFF] = (registers[SECOND_NIBBLE(instr)] % 100) / 10;
+			storage[(I+2) & 0xFFF] = registers[SECOND_NIBBLE(instr)] % 10;
+			Idle::dirty = true;
 			break;
 		// FX55 - store registers V0 - VX values in memory
 		case 0x55:
 			for (int i = 0; i <= SECOND_NIBBLE(instr); ++i)
-				storage[I + i] = registers[i];
+				storage[(I + i) & 0xFFF] = registers[i];
 
 			/* FX55 instruction increments index register 
 				(COSMAC VIP interpreter way)	*/
 			I += SECOND_NIBBLE(instr) + 1;
+			Idle::dirty = true;
 			break;
 		//FX65 - load values from memory to registers
 		case 0x65:
 			for (int i = 0; i <= SECOND_NIBBLE(instr); ++i) 
-				registers[i] = storage[I + i];
+				registers[i] = storage[(I + i) & 0xFFF];
 
 			/* FX65 instruction increments index register 
 				(COSMAC VIP interpreter way)	*/
 			I += SECOND_NIBBLE(instr) + 1;
 			break;
+		default:
+			Chip8::invalidInstruction(instr);
+			break;
 		}
 		break;
 	default:
@@ -383,36 +441,246 @@ void Chip8::decodeAndExecute(const unsigned short& instr)
 // main program loop
 void Chip8::loop()
 {
+	// keys pressed through shared memory
+	Shared::pollKeys();
+
 	// Fetch, decode and execute instructions
-	Chip8::decodeAndExecute(Chip8::instructionFetch());
+	if (!Chip8::halted) {
+		uint64_t emulation_start = Stats::now();
+		Chip8::decodeAndExecute(Chip8::instructionFetch());
+		Stats::emulation(emulation_start);
+		reportHalt();
+	}
 
 	// event check
 	SDL_Event main_event;
-	while(SDL_PollEvent(&main_event)!=0) {
-		switch(main_event.type) {
-		case SDL_KEYDOWN:
-			// press escape to quit
-			if(main_event.key.keysym.scancode==ESCAPE)
-				isRunning = false;
-			Keyboard::state[main_event.key.keysym.scancode] = true;
-			break;
+	while(SDL_PollEvent(&main_event)!=0)
+		Chip8::handleEvent(main_event);
 
-		case SDL_KEYUP:
-			Keyboard::state[main_event.key.keysym.scancode] = false;
-			break;
+	// redraw display
+	if(Display::redraw) {
+		Chip8::present();
+		Shared::publish();
+	}
 
-		case SDL_QUIT:
-			isRunning = false;
+	/* idle loop (or halted program) - instead of spinning through it
+	 * again, let the host sleep until the next timer tick or input event */
+	if (Idle::detected || Chip8::halted) {
+		Idle::reset();
+		if (SDL_WaitEventTimeout(&main_event,17))
+			Chip8::handleEvent(main_event);
+	} else {
+		SDL_Delay(1);
+	}
+}
+
+/* frame based program loop (cycle timing) - execute one frame worth of
+ * instructions at once, then sleep until the next timer tick	*/
+void Chip8::loopFrame()
+{
+	// event check
+	SDL_Event main_event;
+	while(SDL_PollEvent(&main_event)!=0)
+		Chip8::handleEvent(main_event);
+
+	// keys pressed through shared memory
+	Shared::pollKeys();
+
+	Chip8::runFrame();
+	reportHalt();
+
+	/* run-ahead - show the frame the program draws a few frames later
+	 * with the current input, then go back to the real frame. Input
+	 * polled once per game loop shows up without the built-in lag	*/
+	if (Options::runahead) {
+		static Chip8::State state;
+		Chip8::save(state);
+
+		// instructions executed ahead aren't counted as emulation speed
+		Stats::speculative = true;
+		for (int i = 0; i < Options::runahead; ++i)
+			Chip8::runFrame();
+		Stats::speculative = false;
+
+		/* error ahead - show the real frame, the error is reported
+		 * when the program really gets there		*/
+		if (Chip8::halted) Chip8::restore(state);
+
+		/* publish the real frame with the real machine state, but
+		 * show the frame from ahead - swap the pixel buffers for
+		 * presenting						*/
+		static unsigned char ahead[2048];
+		std::copy(Display::buffer, Display::buffer + 2048, ahead);
+		Chip8::restore(state);
+		Shared::publish();
+		std::swap_ranges(ahead, ahead + 2048, Display::buffer);
+		Chip8::present();
+		std::swap_ranges(ahead, ahead + 2048, Display::buffer);
+	} else {
+		Chip8::present();
+		Shared::publish();
+	}
+
+	// sleep until the next 60Hz tick
+	unsigned int tick = Chip8::ticks;
+	while (isRunning && Chip8::ticks == tick)
+		if (SDL_WaitEventTimeout(&main_event,17))
+			Chip8::handleEvent(main_event);
+}
+
+/* execute instructions until the cycle budget of the frame is used up,
+ * then tick the timers				*/
+void Chip8::runFrame()
+{
+	// halted program doesn't run (timers keep ticking)
+	budget = Chip8::halted ? 0 : budget + vip_cycles_per_frame;
+
+	while (budget > 0 && !Chip8::halted) {
+		const unsigned char* start = pc;
+
+		uint64_t emulation_start = Stats::now();
+		unsigned short instr = Chip8::instructionFetch();
+		Chip8::decodeAndExecute(instr);
+		Stats::emulation(emulation_start);
+
+		budget -= Chip8::cycles(instr);
+		/* taken skips cost extra (3XNN, 4XNN, 5XY0, 9XY0, EX9E and
+		 * EXA1 - jumps, calls and returns can land 4 bytes ahead too)	*/
+		switch (FIRST_NIBBLE(instr)) {
+		case 0x3: case 0x4: case 0x5: case 0x9: case 0xE:
+			if (pc - start == 4) budget -= 4;
+		}
+
+		/* DXYN waits for the vertical blank interrupt on the
+		 * COSMAC VIP - the rest of the frame is lost	*/
+		if (FIRST_NIBBLE(instr) == 0xD && budget > 0)
+			budget = 0;
+
+		/* idle loop - the program can't make progress until the
+		 * timers tick at the end of the frame		*/
+		if (Idle::detected) {
+			Idle::reset();
+			budget = std::min(budget, 0);
 		}
 	}
 
-	// redraw display
-	if(Display::redraw) {
-		Display::draw(Display::renderer,Display::texture);
-		Display::redraw = false;	
+	if (delay_timer > 0) delay_timer -= 1;
+	if (sound_timer > 0) sound_timer -= 1;
+}
+
+/* approximate cost of the instruction in COSMAC VIP machine cycles
+ * (interpreter fetch and decode included)			*/
+int Chip8::cycles(const unsigned short& instr)
+{
+	// fetch and decode overhead of the interpreter
+	constexpr int fetch = 40;
+
+	switch (FIRST_NIBBLE(instr)) {
+	case 0x0:
+		// 00E0 clears the whole 256 byte display page
+		return fetch + (instr == 0x00E0 ? 3078 : 10);
+	case 0x1: return fetch + 12;
+	case 0x2: return fetch + 26;
+	case 0x3: case 0x4: return fetch + 10;
+	case 0x5: case 0x9: return fetch + 14;
+	case 0x6: return fetch + 6;
+	case 0x7: return fetch + 10;
+	case 0x8: return fetch + 44;
+	case 0xA: return fetch + 12;
+	case 0xB: return fetch + 22;
+	case 0xC: return fetch + 36;
+	// sprite rows are shifted and XORed byte by byte
+	case 0xD: return fetch + 26 + 68 * FOURTH_NIBBLE(instr);
+	case 0xE: return fetch + 14;
+	case 0xF:
+		switch (NN(instr,0)) {
+		case 0x1E: case 0x29: return fetch + 16;
+		case 0x33: return fetch + 84;
+		// bulk copies cost per register
+		case 0x55: case 0x65: return fetch + 14 + 14 * (SECOND_NIBBLE(instr) + 1);
+		default: return fetch + 10;
+		}
 	}
+	return fetch;
+}
+
+// save the machine state
+void Chip8::save(State& state)
+{
+	std::copy(storage, storage + 4096, state.storage);
+	std::copy(Display::buffer, Display::buffer + 2048, state.display);
+	std::copy(registers, registers + 16, state.registers);
+	state.I = I;
+	state.pc = pc - storage;
+	for (int i = 0; i < 16; ++i)
+		state.stack[i] = stack[i] ? stack[i] - storage : 0;
+	state.sc = sc;
+	state.delay_timer = delay_timer;
+	state.sound_timer = sound_timer;
+	state.released = Keyboard::released;
+	state.waiting = Keyboard::waiting;
+	state.random_state = random_state;
+	state.budget = Chip8::budget;
+	state.halted = Chip8::halted;
+}
 
-	SDL_Delay(1);
+// restore saved machine state
+void Chip8::restore(const State& state)
+{
+	std::copy(state.storage, state.storage + 4096, storage);
+	std::copy(state.display, state.display + 2048, Display::buffer);
+	std::copy(state.registers, state.registers + 16, registers);
+	I = state.I;
+	pc = &storage[state.pc];
+	// entries above the stack counter are empty
+	for (int i = 0; i < 16; ++i)
+		stack[i] = i < state.sc ? &storage[state.stack[i]] : nullptr;
+	sc = state.sc;
+	delay_timer = state.delay_timer;
+	sound_timer = state.sound_timer;
+	Keyboard::released = state.released;
+	Keyboard::waiting = state.waiting;
+	random_state = state.random_state;
+	Chip8::budget = state.budget;
+	Chip8::halted = state.halted;
+
+	// saved idle loop state belongs to the discarded frames
+	Idle::reset();
+}
+
+// redraw display and hand the frame to statistics and capture
+void Chip8::present()
+{
+	uint64_t draw_start = Stats::now();
+	Display::draw(Display::renderer,Display::texture);
+	Stats::draw(draw_start);
+	Capture::push(Display::buffer);
+	Display::redraw = false;	
+}
+
+// handle SDL event in the standard execution loop
+void Chip8::handleEvent(const SDL_Event& event)
+{
+	++Stats::events;
+
+	switch(event.type) {
+	case SDL_KEYDOWN:
+		// press escape to quit
+		if(event.key.keysym.scancode==ESCAPE)
+			isRunning = false;
+		Keyboard::state[event.key.keysym.scancode] = true;
+		Idle::reset();
+		break;
+
+	case SDL_KEYUP:
+		Keyboard::state[event.key.keysym.scancode] = false;
+		Keyboard::release(event.key.keysym.scancode);
+		Idle::reset();
+		break;
+
+	case SDL_QUIT:
+		isRunning = false;
+	}
 }
 
 // debug mode program loop
@@ -444,6 +712,7 @@ void Chip8::loopDebug(uint8_t& options)
 
 		case SDL_KEYUP:
 			Keyboard::state[main_event.key.keysym.scancode] = false;
+			Keyboard::release(main_event.key.keysym.scancode);
 			break;
 
 		case SDL_QUIT:
@@ -452,7 +721,7 @@ void Chip8::loopDebug(uint8_t& options)
 	}
 
 	// execution flow controlled by user
-	if(options & ADVANCE) {
+	if((options & ADVANCE) && !Chip8::halted) {
 		// fetch instruction
 		unsigned short instr = Chip8::instructionFetch();
 		
@@ -463,6 +732,7 @@ void Chip8::loopDebug(uint8_t& options)
 		std::cout << "Executed instruction: " 		
 			<< std::setfill('0') << std::setw(4) << std::hex
 			<< instr << '\n';
+		reportHalt();
 	}
 
 	// display current registers values
@@ -478,11 +748,41 @@ void Chip8::loopDebug(uint8_t& options)
 	
 	// update display
 	if(Display::redraw) {
-		Display::draw(Display::renderer,Display::texture);
-		Display::redraw = false;	
+		Chip8::present();
+		Shared::publish();
 	}
 }
 
+/* stop the program on an error - pc goes back to the instruction
+ * executed last (the error is reported once by the main loop)	*/
+void Chip8::halt(const std::string& error)
+{
+	std::ostringstream oss;
+	oss << "Error: " << error << " at 0x" << std::setfill('0') << std::setw(3)
+		<< std::hex << (fetched - storage) << '\n';
+	halt_error = oss.str();
+
+	pc = fetched;
+	Chip8::halted = true;
+}
+
+// halt on instruction that can't be decoded
+void Chip8::invalidInstruction(const unsigned short& instr)
+{
+	std::ostringstream oss;
+	oss << "invalid instruction " << std::setfill('0') << std::setw(4)
+		<< std::hex << instr;
+	Chip8::halt(oss.str());
+}
+
+// record release of the key (if it's one of CHIP-8 keys)
+void Keyboard::release(const int& scancode)
+{
+	for (int i = 0; i < 16; ++i)
+		if (scancode == Keyboard::scancodes[i])
+			Keyboard::released |= 1 << i;
+}
+
 // increment program counter
 void Chip8::incrementPC(const int& n)
 {
@@ -492,11 +792,20 @@ void Chip8::incrementPC(const int& n)
 // callback function for SDL_AddTimer() - ticking at 60Hz
 uint32_t Chip8::timerCallback(uint32_t interval, void* param)
 {
-	// decrement timer registers
-	if (delay_timer > 0) delay_timer -= 1;	
-	if (sound_timer > 0) sound_timer -= 1;	
+	/* decrement timer registers (ticked by Chip8::runFrame with cycle
+	 * timing, the debugger doesn't run frames)		*/
+	if (!Options::timing || Options::debug) {
+		if (delay_timer > 0) delay_timer -= 1;	
+		if (sound_timer > 0) sound_timer -= 1;	
+	}
 
 	Display::redraw = true;
+	++Chip8::ticks;
+
+	// wake up the main loop if it's sleeping in an idle loop
+	SDL_Event tick_event;
+	tick_event.type = SDL_USEREVENT;
+	SDL_PushEvent(&tick_event);
 
 	// return next 17ms interval to the timer
 	return 17;
@@ -1,21 +1,19 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <SDL.h>
 #include <stdexcept>
+#include <thread>
 #include <vector>
-
-// macros for extracting nibbles from 4 digit hex numbers
-#define FIRST_NIBBLE(instr) (instr >> 12)
-#define SECOND_NIBBLE(instr) ((instr & 0x0F00) >> 8)
-#define THIRD_NIBBLE(instr) ((instr & 0x00F0) >> 4)
-#define FOURTH_NIBBLE(instr) (instr & 0x000F)
-#define NNN(instr) (instr & 0x0FFF)
-#define NN(instr, n) ((instr >> n) & 0x00FF)
-
-// calculate pixel buffer index based on coordinates
-#define PIXEL_INDEX(X, x_offset, Y, y_offset) (X+x_offset+(Y+y_offset)*64)
+#include "shared.h"
+#include "batch.h"
+#include "capture.h"
 
 // key bindings
 #define ESCAPE SDL_SCANCODE_ESCAPE
@@ -61,10 +59,40 @@ extern unsigned char* stack[16];
 // stack counter
 extern unsigned char sc;
 
-// font
-extern unsigned char font[90];
+// random number generator state (CXNN)
+extern uint32_t random_state;
 
 namespace Chip8 {
+	/* COSMAC VIP machine cycles per 60Hz frame
+	 * (1.76 MHz clock, 8 clock cycles per machine cycle)	*/
+	constexpr int vip_cycles_per_frame = 3668;
+
+	// cycles left over (or overspent) by the previous frame
+	extern int budget;
+
+	/* flag set when the program stopped on an error (pc is left on the
+	 * failing instruction, the window stays open)		*/
+	extern bool halted;
+
+	/* copy of the whole machine state (memory, display, registers,
+	 * timers, stack, pending FX0A and random generator state)	*/
+	struct State {
+		unsigned char storage[4096];
+		unsigned char display[2048];
+		unsigned char registers[16];
+		unsigned short I;
+		unsigned short pc;
+		unsigned short stack[16];
+		unsigned char sc;
+		unsigned char delay_timer;
+		unsigned char sound_timer;
+		unsigned short released;
+		bool waiting;
+		uint32_t random_state;
+		int budget;
+		bool halted;
+	};
+
 	// initialize 
 	void init();
 	// load program into memory
@@ -73,14 +101,34 @@ namespace Chip8 {
 	unsigned short instructionFetch();
 	// decode and execute
 	void decodeAndExecute(const unsigned short& instr);
+	// stop the program on an error at the instruction executed last
+	void halt(const std::string& error);
+	// halt on instruction that can't be decoded
+	void invalidInstruction(const unsigned short& instr);
 	// main program loop
 	void loop();
 	// debug mode program loop
 	void loopDebug(uint8_t&);
+	// frame based program loop (cycle timing)
+	void loopFrame();
+	// execute one frame worth of instructions and tick the timers
+	void runFrame();
+	// approximate cost of the instruction in COSMAC VIP machine cycles
+	int cycles(const unsigned short& instr);
+	// redraw display and hand the frame to statistics and capture
+	void present();
+	// save the machine state
+	void save(State&);
+	// restore saved machine state
+	void restore(const State&);
 	// increment program counter
 	void incrementPC(const int&);
+	// handle SDL event in the standard execution loop
+	void handleEvent(const SDL_Event&);
 	// callback function for SDL_AddTimer() (decrement timer registers by 1 every 17ms(60Hz))
 	uint32_t timerCallback(uint32_t, void*);
+	// number of timer ticks since start (incremented by timerCallback)
+	extern std::atomic<unsigned int> ticks;
 }
 
 namespace Display {
@@ -116,6 +164,25 @@ namespace Keyboard {
 					           KEY_C, KEY_D, KEY_E, KEY_F };
 	// array of states of keys (pressed or not)
 	extern bool state[322];
+	// bit mask of CHIP-8 keys released since FX0A started waiting
+	extern unsigned short released;
+	// flag indicating whether FX0A is waiting for a key
+	extern bool waiting;
+	// record release of the key (if it's one of CHIP-8 keys)
+	void release(const int& scancode);
+}
+
+namespace Idle {
+	/* flag indicating that the program spins in a loop that can't make
+	 * progress before the next timer tick or input event	*/
+	extern bool detected;
+	/* flag indicating that an instruction changed the machine state
+	 * outside of the registers since the last check	*/
+	extern bool dirty;
+	// compare machine state with the one saved at the last backward jump
+	void check(const unsigned char* target);
+	// forget the saved state
+	void reset();
 }
 
 namespace Options {
@@ -125,4 +192,52 @@ namespace Options {
 	extern bool debug;
 	// path to the file to open
 	extern std::string filename;
+	// path to the capture file (empty if not capturing)
+	extern std::string capture;
+	// path to the statistics file ("-" for stdout, empty if not exporting)
+	extern std::string stats;
+	// statistics overlay flag
+	extern bool overlay;
+	// name of the shared memory region (empty if not publishing)
+	extern std::string shared;
+	// cycle timing flag (COSMAC VIP instruction costs, frame based execution)
+	extern bool timing;
+	// number of frames to run ahead (0 - run-ahead disabled)
+	extern int runahead;
 }
+
+namespace Shared {
+	// create and map the region /dev/shm/<name>
+	void start(const std::string& name);
+	// publish the pixel buffer and registers (called for every presented frame)
+	void publish();
+	// apply keys pressed by external processes
+	void pollKeys();
+	// unmap and remove the region
+	void stop();
+}
+
+namespace Stats {
+	// flags indicating whether statistics are collected and shown on screen
+	extern bool enabled;
+	extern bool overlay;
+	// instructions executed and events polled in the current second
+	extern unsigned long instructions;
+	extern unsigned long events;
+	/* flag set while run-ahead frames are executed and instructions
+	 * executed in them (thrown away, counted separately)	*/
+	extern bool speculative;
+	extern unsigned long speculative_instructions;
+
+	// start collecting statistics, export them to file ("-" for stdout)
+	void start(const std::string& filename, const bool& show_overlay);
+	// current performance counter value (0 if statistics are disabled)
+	uint64_t now();
+	// count instruction executed since start
+	void emulation(const uint64_t& start);
+	// count frame drawn since start, report once per second
+	void draw(const uint64_t& start);
+	// draw the statistics overlay in the top left corner of the window
+	void drawOverlay(SDL_Renderer*);
+}
+
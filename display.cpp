@@ -33,6 +33,10 @@ void Display::draw(SDL_Renderer* renderer, SDL_Texture* texture)
 	// copy the texture to the window
 	SDL_RenderCopy(renderer,texture,NULL,NULL);
 
+	// statistics overlay on top of the display
+	if (Stats::overlay)
+		Stats::drawOverlay(renderer);
+
 	// update the window with the latest rendering operations
 	SDL_RenderPresent(renderer);
 }
@@ -40,40 +44,9 @@ void Display::draw(SDL_Renderer* renderer, SDL_Texture* texture)
 // DXYN - display sprite
 void Display::drawSprite(const unsigned short& instr)
 {
-	// location stored in registers specified by X,Y
-	unsigned char X = registers[SECOND_NIBBLE(instr)] % 64;
-	unsigned char Y = registers[THIRD_NIBBLE(instr)] % 32;
-
-	// sprite starts at memory address stored in I register
-	unsigned char* sprite = &storage[I];
-
-	// set flag register to 0
-	registers[0xF] = 0;
-
-	// for every row of the sprite
-	for (int y_offset = 0; y_offset < FOURTH_NIBBLE(instr); ++y_offset) {
-		// for every bit of the row
-		for (int x_offset = 0; x_offset < 8; ++x_offset) {
-			/* range checking bit and checking whether sprite
-			 	is being drawn on the same row */
-			if (PIXEL_INDEX(X, x_offset, Y, y_offset) < 2048 &&
-			((X+x_offset) < (64+64*Y+y_offset))) {
-				/* variable current_bit - pixel of the
-					sprite currently being drawn 	*/
-				bool current_bit = (*sprite >> 7-x_offset) & 0b00000001;
-
-				/*  checking if pixel collision occurs
-				       	   if so, set VF to 1 		*/
-				if (Display::buffer[PIXEL_INDEX(X, x_offset, Y, y_offset)]
-				&& current_bit) {
-					registers[0xF] = 1;
-				}
-
-				// XOR bit with currently drawn pixel
-				Display::buffer[PIXEL_INDEX(X, x_offset, Y, y_offset)]
-					^= current_bit;
-			} 
-		}
-		++sprite;
-	}
+	/* location stored in registers specified by X,Y, sprite starts
+	 * at memory address stored in I register; VF is set on collision */
+	registers[0xF] = Display::blit(Display::buffer, storage, I,
+		registers[SECOND_NIBBLE(instr)], registers[THIRD_NIBBLE(instr)],
+		FOURTH_NIBBLE(instr));
 }
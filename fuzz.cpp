@@ -0,0 +1,587 @@
+/* Differential fuzzing harness for the CPU core.
+ *
+ * Every input is turned into a machine state (registers, I, timers,
+ * stack, keys, program counter) and a program written at the program
+ * counter. Up to max_steps instructions are then executed by
+ * Chip8::decodeAndExecute, by several lanes of the batch engine and by
+ * the simple reference implementation below (one per lane), and the
+ * machine states are compared after every instruction. Any difference
+ * aborts.
+ *
+ * libFuzzer:  make fuzz && ./fuzz
+ * standalone: make fuzz-standalone && ./fuzz [input files]
+ *   (without input files random programs are run until interrupted and
+ *    the number of executed instructions per second is printed; with
+ *    files it can be used as an AFL target: afl-fuzz ... -- ./fuzz @@) */
+#include "chip8.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// globals defined by main.cpp in the emulator
+bool isRunning = true;
+SDL_Window* Display::window = nullptr;
+SDL_Renderer* Display::renderer = nullptr;
+SDL_Texture* Display::texture = nullptr;
+
+// instructions executed per input
+constexpr int max_steps = 64;
+// cycles a lane caught in an idle loop sleeps (Batch::step keeps it until the frame ends)
+constexpr int idle_cycles = 8;
+
+// instructions executed since start
+static unsigned long long executed = 0;
+
+/* reference machine - the obvious implementation of every instruction,
+ * kept free of any optimization				*/
+struct Reference {
+	unsigned char memory[4096];
+	unsigned char display[2048];
+	unsigned char V[16];
+	unsigned short I;
+	unsigned short pc;
+	unsigned short stack[16];
+	unsigned char sc;
+	unsigned char delay_timer;
+	unsigned char sound_timer;
+	unsigned short keys;
+	unsigned short released;
+	bool waiting;
+};
+
+// program counter can't be moved past the end of memory
+static unsigned short skip(const unsigned short& pc, const int& n)
+{
+	if (pc + n > 0xFFF) return pc;
+	return pc + n;
+}
+
+// execute one instruction, return false if it's invalid
+static bool referenceStep(Reference& r)
+{
+	unsigned short instr = r.memory[r.pc] << 8 | r.memory[(r.pc + 1) % 4096];
+	r.pc = skip(r.pc, 2);
+
+	int x = (instr >> 8) & 0xF;
+	int y = (instr >> 4) & 0xF;
+	int n = instr & 0xF;
+	unsigned char nn = instr & 0xFF;
+	unsigned short nnn = instr & 0xFFF;
+
+	switch (instr >> 12) {
+	case 0x0:
+		if (instr == 0x00E0) {
+			std::memset(r.display, 0, sizeof(r.display));
+		} else if (instr == 0x00EE) {
+			if (r.sc == 0) return false;
+			r.sc -= 1;
+			r.pc = r.stack[r.sc];
+			r.stack[r.sc] = 0;
+		}
+		// 0NNN (SYS) is ignored
+		return true;
+	case 0x1:
+		r.pc = nnn;
+		return true;
+	case 0x2:
+		if (r.sc == 16) return false;
+		r.stack[r.sc] = r.pc;
+		r.sc += 1;
+		r.pc = nnn;
+		return true;
+	case 0x3:
+		if (r.V[x] == nn) r.pc = skip(r.pc, 2);
+		return true;
+	case 0x4:
+		if (r.V[x] != nn) r.pc = skip(r.pc, 2);
+		return true;
+	case 0x5:
+		if (n != 0) return false;
+		if (r.V[x] == r.V[y]) r.pc = skip(r.pc, 2);
+		return true;
+	case 0x6:
+		r.V[x] = nn;
+		return true;
+	case 0x7:
+		r.V[x] = (r.V[x] + nn) & 0xFF;
+		return true;
+	case 0x8: {
+		int vx = r.V[x];
+		int vy = r.V[y];
+		switch (n) {
+		case 0x0: r.V[x] = vy; break;
+		case 0x1: r.V[x] = vx | vy; break;
+		case 0x2: r.V[x] = vx & vy; break;
+		case 0x3: r.V[x] = vx ^ vy; break;
+		case 0x4:
+			r.V[x] = (vx + vy) & 0xFF;
+			r.V[0xF] = vx + vy > 0xFF ? 1 : 0;
+			break;
+		case 0x5:
+			r.V[x] = (vx - vy) & 0xFF;
+			r.V[0xF] = vx >= vy ? 1 : 0;
+			break;
+		// shifts read VY again after VX was written (X == Y case)
+		case 0x6:
+			r.V[x] = vy >> 1;
+			r.V[0xF] = r.V[y] & 1;
+			break;
+		case 0x7:
+			r.V[x] = (vy - vx) & 0xFF;
+			r.V[0xF] = vy >= vx ? 1 : 0;
+			break;
+		case 0xE:
+			r.V[x] = (vy << 1) & 0xFF;
+			r.V[0xF] = r.V[y] >> 7;
+			break;
+		default:
+			return false;
+		}
+		return true;
+	}
+	case 0x9:
+		if (n != 0) return false;
+		if (r.V[x] != r.V[y]) r.pc = skip(r.pc, 2);
+		return true;
+	case 0xA:
+		r.I = nnn;
+		return true;
+	case 0xB:
+		r.pc = skip(nnn, r.V[0]);
+		return true;
+	// CXNN - random value is copied from the core by the harness
+	case 0xC:
+		r.V[x] = 0;
+		return true;
+	case 0xD: {
+		int X = r.V[x] % 64;
+		int Y = r.V[y] % 32;
+		bool collision = false;
+		for (int row = 0; row < n; ++row) {
+			unsigned char bits = r.memory[(r.I + row) % 4096];
+			for (int col = 0; col < 8; ++col) {
+				int index = X + col + (Y + row) * 64;
+				// pixels past the right edge continue on the next row
+				if (index >= 2048 || X + col >= 64 + 64 * Y + row) continue;
+				int bit = (bits >> (7 - col)) & 1;
+				if (bit && r.display[index]) collision = true;
+				r.display[index] ^= bit;
+			}
+		}
+		r.V[0xF] = collision;
+		return true;
+	}
+	case 0xE:
+		if (nn == 0x9E) {
+			if (r.keys >> (r.V[x] & 0xF) & 1) r.pc = skip(r.pc, 2);
+		} else if (nn == 0xA1) {
+			if (!(r.keys >> (r.V[x] & 0xF) & 1)) r.pc = skip(r.pc, 2);
+		} else {
+			return false;
+		}
+		return true;
+	case 0xF:
+		switch (nn) {
+		case 0x07: r.V[x] = r.delay_timer; break;
+		case 0x15: r.delay_timer = r.V[x]; break;
+		case 0x18: r.sound_timer = r.V[x]; break;
+		case 0x1E:
+			if (r.I + r.V[x] > 0xFFF) r.V[0xF] = 1;
+			r.I = (r.I + r.V[x]) & 0xFFFF;
+			break;
+		case 0x0A:
+			if (!r.waiting) {
+				r.waiting = true;
+				r.released = 0;
+			}
+			if (r.released == 0) {
+				r.pc -= 2;
+				break;
+			}
+			for (int key = 0; key < 16; ++key) {
+				if (r.released >> key & 1) {
+					r.V[x] = key;
+					break;
+				}
+			}
+			r.waiting = false;
+			r.released = 0;
+			break;
+		case 0x29: r.I = r.V[x] * 5; break;
+		case 0x33:
+			r.memory[r.I % 4096] = r.V[x] / 100;
+			r.memory[(r.I + 1) % 4096] = r.V[x] / 10 % 10;
+			r.memory[(r.I + 2) % 4096] = r.V[x] % 10;
+			break;
+		case 0x55:
+			for (int i = 0; i <= x; ++i) r.memory[(r.I + i) % 4096] = r.V[i];
+			r.I = (r.I + x + 1) & 0xFFFF;
+			break;
+		case 0x65:
+			for (int i = 0; i <= x; ++i) r.V[i] = r.memory[(r.I + i) % 4096];
+			r.I = (r.I + x + 1) & 0xFFFF;
+			break;
+		default:
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+/* machines compared with the references - lane 0 of the batch engine and
+ * the core start from the input state, the other lanes from the same
+ * state with different keys and one changed register, so they diverge
+ * at key and register dependent instructions and split the runs of
+ * equal instructions					*/
+constexpr int lanes = 4;
+static Reference reference[lanes];
+static Batch::Machines batch;
+
+// print the difference and stop
+static void mismatch(const char* what, const int& lane, const unsigned short& instr, const int& step)
+{
+	std::fprintf(stderr, "fuzz: %s differs in lane %d after instruction %04x (step %d)\n",
+		what, lane, instr, step);
+	std::abort();
+}
+
+// compare the core with the reference of lane 0
+static void compareCore(const unsigned short& instr, const int& step)
+{
+	const Reference& r = reference[0];
+
+	for (int i = 0; i < 16; ++i) {
+		if (registers[i] != r.V[i])
+			mismatch("V register", 0, instr, step);
+
+		unsigned short core_stack = stack[i] ? stack[i] - storage : 0;
+		if (core_stack != r.stack[i])
+			mismatch("stack", 0, instr, step);
+	}
+
+	if (I != r.I)
+		mismatch("I", 0, instr, step);
+	if (pc - storage != r.pc)
+		mismatch("program counter", 0, instr, step);
+	if (sc != r.sc)
+		mismatch("stack counter", 0, instr, step);
+	if (delay_timer != r.delay_timer || sound_timer != r.sound_timer)
+		mismatch("timer", 0, instr, step);
+	if (Keyboard::waiting != r.waiting)
+		mismatch("FX0A state", 0, instr, step);
+
+	// memory and pixel buffers only after instructions writing them
+	if ((instr & 0xF0FF) == 0xF033 || (instr & 0xF0FF) == 0xF055)
+		if (std::memcmp(storage, r.memory, 4096))
+			mismatch("memory", 0, instr, step);
+	if (instr == 0x00E0 || FIRST_NIBBLE(instr) == 0xD)
+		if (std::memcmp(Display::buffer, r.display, 2048))
+			mismatch("display", 0, instr, step);
+}
+
+// compare the batch lane with its reference
+static void compareLane(const int& l, const unsigned short& instr, const int& step)
+{
+	const Reference& r = reference[l];
+
+	for (int i = 0; i < 16; ++i) {
+		if (batch.registers[i][l] != r.V[i])
+			mismatch("V register", l, instr, step);
+		if (batch.stack[i][l] != r.stack[i])
+			mismatch("stack", l, instr, step);
+	}
+
+	if (batch.I[l] != r.I)
+		mismatch("I", l, instr, step);
+	if (batch.pc[l] != r.pc)
+		mismatch("program counter", l, instr, step);
+	if (batch.sc[l] != r.sc)
+		mismatch("stack counter", l, instr, step);
+	if (batch.delay_timer[l] != r.delay_timer || batch.sound_timer[l] != r.sound_timer)
+		mismatch("timer", l, instr, step);
+	if (bool(batch.waiting[l]) != r.waiting)
+		mismatch("FX0A state", l, instr, step);
+
+	if ((instr & 0xF0FF) == 0xF033 || (instr & 0xF0FF) == 0xF055)
+		if (std::memcmp(&batch.memory[l * 4096], r.memory, 4096))
+			mismatch("memory", l, instr, step);
+	if (instr == 0x00E0 || FIRST_NIBBLE(instr) == 0xD)
+		if (std::memcmp(&batch.display[l * 2048], r.display, 2048))
+			mismatch("display", l, instr, step);
+}
+
+// load the machine state described by the input into all machines
+static void setup(const uint8_t* data, size_t size)
+{
+	// state header (missing bytes are zero)
+	uint8_t header[60] = {};
+	std::memcpy(header, data, std::min<size_t>(size, sizeof(header)));
+	const uint8_t* program = data + sizeof(header);
+	size_t program_size = size > sizeof(header) ? size - sizeof(header) : 0;
+
+	Reference& r = reference[0];
+	std::memset(&r, 0, sizeof(r));
+	std::memcpy(r.V, header, 16);
+	r.I = header[16] | header[17] << 8;
+	r.delay_timer = header[18];
+	r.sound_timer = header[19];
+	r.sc = header[20] % 17;
+	for (int i = 0; i < r.sc; ++i)
+		r.stack[i] = (header[21 + 2 * i] | header[22 + 2 * i] << 8) & 0xFFF;
+	r.keys = header[53] | header[54] << 8;
+	r.released = header[55] | header[56] << 8;
+	r.waiting = header[57] & 1;
+	r.pc = (header[58] | header[59] << 8) & 0xFFF;
+
+	// font, then the program written at the program counter
+	std::memcpy(r.memory, font, sizeof(font));
+	for (size_t i = 0; i < program_size && i < 4096; ++i)
+		r.memory[(r.pc + i) % 4096] = program[i];
+
+	// other lanes - different keys and one changed register
+	for (int l = 1; l < lanes; ++l) {
+		reference[l] = r;
+		reference[l].keys ^= 0x1111 << (l - 1);
+		reference[l].V[l] ^= 1 << l;
+	}
+
+	// core
+	std::memcpy(storage, r.memory, 4096);
+	std::memcpy(registers, r.V, 16);
+	std::memset(Display::buffer, 0, 2048);
+	I = r.I;
+	pc = &storage[r.pc];
+	sc = r.sc;
+	for (int i = 0; i < 16; ++i) stack[i] = i < r.sc ? &storage[r.stack[i]] : nullptr;
+	delay_timer = r.delay_timer;
+	sound_timer = r.sound_timer;
+	std::memset(Keyboard::state, 0, sizeof(Keyboard::state));
+	for (int i = 0; i < 16; ++i)
+		Keyboard::state[Keyboard::scancodes[i]] = r.keys >> i & 1;
+	Keyboard::released = r.released;
+	Keyboard::waiting = r.waiting;
+	random_state = 1;
+	Chip8::halted = false;
+	Idle::reset();
+
+	// batch engine lanes
+	Batch::Machines& b = batch;
+	b.lanes = lanes;
+	for (int i = 0; i < 16; ++i) {
+		b.registers[i].resize(lanes);
+		b.stack[i].resize(lanes);
+	}
+	for (auto* v : { &b.I, &b.pc, &b.keys, &b.released, &b.instr, &b.address })
+		v->resize(lanes);
+	for (auto* v : { &b.delay_timer, &b.sound_timer, &b.sc, &b.waiting })
+		v->resize(lanes);
+	b.memory.resize(lanes * 4096);
+
+	for (int l = 0; l < lanes; ++l) {
+		const Reference& lr = reference[l];
+		for (int i = 0; i < 16; ++i) {
+			b.registers[i][l] = lr.V[i];
+			b.stack[i][l] = lr.stack[i];
+		}
+		b.I[l] = lr.I;
+		b.pc[l] = lr.pc;
+		b.address[l] = lr.pc;
+		b.delay_timer[l] = lr.delay_timer;
+		b.sound_timer[l] = lr.sound_timer;
+		b.sc[l] = lr.sc;
+		b.keys[l] = lr.keys;
+		b.released[l] = lr.released;
+		b.waiting[l] = lr.waiting;
+		std::memcpy(&b.memory[l * 4096], lr.memory, 4096);
+	}
+	b.rng.assign(lanes, 1);
+	b.halted.assign(lanes, 0);
+	b.instr.assign(lanes, 0);
+	b.display.assign(lanes * 2048, 0);
+	b.stopped.assign(lanes, 0);
+	b.idle.assign(lanes, 0);
+	b.dirty.assign(lanes, 1);
+	b.saved_target.assign(lanes, 0);
+	b.saved_I.assign(lanes, 0);
+	b.saved_sc.assign(lanes, 0);
+	b.saved_registers.assign(lanes * 16, 0);
+	b.saved_stack.assign(lanes * 16, 0);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	setup(data, size);
+
+	/* lanes still running, addresses of instructions that halted the
+	 * others and cycles left to sleep for idle lanes		*/
+	bool running[lanes];
+	unsigned short fault[lanes] = {};
+	int sleeping[lanes] = {};
+	std::fill(running, running + lanes, true);
+
+	for (int step = 0; step < max_steps; ++step) {
+		unsigned short instr[lanes];
+		bool valid[lanes];
+		for (int l = 0; l < lanes; ++l) {
+			const Reference& r = reference[l];
+			instr[l] = r.memory[r.pc] << 8 | r.memory[(r.pc + 1) % 4096];
+			fault[l] = running[l] ? r.pc : fault[l];
+		}
+
+		// the core follows lane 0
+		if (running[0] && !sleeping[0])
+			Chip8::decodeAndExecute(Chip8::instructionFetch());
+		bool core_valid = !Chip8::halted;
+
+		for (int l = 0; l < lanes; ++l)
+			if (running[l] && !sleeping[l]) {
+				valid[l] = referenceStep(reference[l]);
+				++executed;
+			}
+		Batch::cycle(batch);
+
+		for (int l = 0; l < lanes; ++l) {
+			// halted lanes stay on the failing instruction
+			if (!running[l]) {
+				if (!batch.halted[l] || batch.pc[l] != fault[l])
+					mismatch("halted lane", l, instr[l], step);
+				continue;
+			}
+
+			/* idle lanes are skipped - they must keep their state
+			 * even if a lane in the same run faults	*/
+			if (sleeping[l]) {
+				if (batch.halted[l] || batch.pc[l] != reference[l].pc)
+					mismatch("idle lane", l, instr[l], step);
+				if (--sleeping[l] == 0) batch.idle[l] = 0;
+				continue;
+			}
+
+			if ((l == 0 && core_valid != valid[l]) || bool(batch.halted[l]) == valid[l])
+				mismatch("validity", l, instr[l], step);
+			// machine state after an error is unspecified, except pc
+			if (!valid[l]) {
+				if (batch.pc[l] != fault[l] || (l == 0 && pc - storage != fault[l]))
+					mismatch("halted program counter", l, instr[l], step);
+				running[l] = false;
+				continue;
+			}
+
+			/* CXNN - random value must fit the mask, then it's shared
+			 * (taken from the core in lane 0)		*/
+			if (FIRST_NIBBLE(instr[l]) == 0xC) {
+				unsigned char& value = batch.registers[SECOND_NIBBLE(instr[l])][l];
+				if (l == 0) {
+					if (registers[SECOND_NIBBLE(instr[l])] & ~NN(instr[l],0))
+						mismatch("CXNN mask", l, instr[l], step);
+					value = registers[SECOND_NIBBLE(instr[l])];
+				}
+				if (value & ~NN(instr[l],0))
+					mismatch("CXNN mask", l, instr[l], step);
+				reference[l].V[SECOND_NIBBLE(instr[l])] = value;
+			}
+
+			if (l == 0) {
+				compareCore(instr[l], step);
+
+				/* idle loops must be detected at the same instruction,
+				 * then the core sleeps with lane 0		*/
+				if (Idle::detected != bool(batch.idle[l]))
+					mismatch("idle detection", l, instr[l], step);
+				if (Idle::detected) Idle::reset();
+			}
+			compareLane(l, instr[l], step);
+			if (batch.idle[l]) sleeping[l] = idle_cycles;
+		}
+
+		if (std::find(running, running + lanes, true) == running + lanes) break;
+	}
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+// xorshift32 for random inputs
+static uint32_t generator_state = 2463534242u;
+static uint32_t random32()
+{
+	generator_state ^= generator_state << 13;
+	generator_state ^= generator_state >> 17;
+	generator_state ^= generator_state << 5;
+	return generator_state;
+}
+
+/* random instruction - mostly well-formed ones (with small operands
+ * for sprites and memory copies), sometimes any 16 bit value	*/
+static unsigned short randomInstruction()
+{
+	static const unsigned short forms[] = {
+		0x00E0, 0x00EE, 0x1000, 0x2000, 0x3000, 0x4000, 0x5000, 0x6000,
+		0x7000, 0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006,
+		0x8007, 0x800E, 0x9000, 0xA000, 0xB000, 0xC000, 0xD000, 0xE09E,
+		0xE0A1, 0xF007, 0xF00A, 0xF015, 0xF018, 0xF01E, 0xF029, 0xF033,
+		0xF055, 0xF065 };
+	uint32_t r = random32();
+	if (r % 16 == 0) return r >> 16;
+
+	unsigned short form = forms[(r >> 4) % (sizeof(forms) / sizeof(forms[0]))];
+	unsigned short operands = r >> 16;
+	switch (form >> 12) {
+	case 0x0: return form;
+	case 0x1: case 0x2: case 0xA: case 0xB:
+		// stay close to the program most of the time
+		return form | (operands & 0x3F);
+	case 0x3: case 0x4: case 0x6: case 0x7: case 0xC:
+		return form | (operands & 0x0FFF);
+	case 0x5: case 0x8: case 0x9:
+		return form | (operands & 0x0FF0);
+	case 0xD:
+		return form | (operands & 0x0FFF);
+	default:
+		// EXNN and FXNN - only the register varies
+		return form | (operands & 0x0F00);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// run inputs from files
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i) {
+			std::ifstream ifs {argv[i], std::ios_base::binary};
+			std::vector<uint8_t> input((std::istreambuf_iterator<char>(ifs)),
+				std::istreambuf_iterator<char>());
+			LLVMFuzzerTestOneInput(input.data(), input.size());
+		}
+		return 0;
+	}
+
+	// random inputs until interrupted
+	uint8_t input[60 + 2 * max_steps];
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long inputs = 0;
+
+	for (;;) {
+		for (int i = 0; i < 60; ++i) input[i] = random32();
+		// program counter at 0x200, programs jump within the first 64 bytes
+		input[58] = 0x00;
+		input[59] = 0x02;
+		for (int i = 0; i < max_steps; ++i) {
+			unsigned short instr = randomInstruction();
+			if (instr >> 12 == 0x1 || instr >> 12 == 0x2 || instr >> 12 == 0xB)
+				instr += 0x200;
+			input[60 + 2 * i] = instr >> 8;
+			input[61 + 2 * i] = instr & 0xFF;
+		}
+		LLVMFuzzerTestOneInput(input, sizeof(input));
+
+		if (++inputs % 100000 == 0) {
+			std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			std::printf("%llu inputs, %llu instructions, %.2f M instructions/s\n",
+				inputs, executed, executed / elapsed.count() / 1e6);
+			std::fflush(stdout);
+		}
+	}
+}
+#endif
@@ -0,0 +1,49 @@
+#include "chip8.h"
+
+/* flag set when the same backward jump is reached twice with the same
+ * 		machine state (idle loop)			*/
+bool Idle::detected = false;
+
+/* flag set by instructions changing memory, display, timers or random
+ * 		state (there's no saved state at start)		*/
+bool Idle::dirty = true;
+
+// machine state saved at the last backward jump
+static const unsigned char* saved_target = nullptr;
+static unsigned char saved_registers[16];
+static unsigned short saved_I = 0;
+static unsigned char* saved_stack[16];
+static unsigned char saved_sc = 0;
+static unsigned int saved_ticks = 0;
+
+/* compare machine state with the one saved at the last backward jump
+ * (called on every jump to the same or lower address).
+ * If nothing but the program counter moved since then, the loop will
+ * repeat itself until the delay timer ticks or a key changes state	*/
+void Idle::check(const unsigned char* target)
+{
+	if (!Idle::dirty && target == saved_target && I == saved_I
+	&& sc == saved_sc && Chip8::ticks == saved_ticks
+	&& std::equal(registers, registers + 16, saved_registers)
+	&& std::equal(stack, stack + 16, saved_stack)) {
+		Idle::detected = true;
+		return;
+	}
+
+	// save current state
+	saved_target = target;
+	saved_I = I;
+	saved_sc = sc;
+	saved_ticks = Chip8::ticks;
+	std::copy(registers, registers + 16, saved_registers);
+	std::copy(stack, stack + 16, saved_stack);
+
+	Idle::dirty = false;
+}
+
+// forget the saved state (e.g. after input event)
+void Idle::reset()
+{
+	Idle::detected = false;
+	Idle::dirty = true;
+}
@@ -14,6 +14,18 @@ try {
 	// initialize
 	Chip8::init();
 
+	// start collecting statistics
+	if (!Options::stats.empty() || Options::overlay)
+		Stats::start(Options::stats, Options::overlay);
+
+	// share frames and keys with external processes
+	if (!Options::shared.empty())
+		Shared::start(Options::shared);
+
+	// start recording presented frames
+	if (!Options::capture.empty())
+		Capture::start(Options::capture);
+
 	// initialize global clock (60Hz)
 	SDL_TimerID timerID = SDL_AddTimer(17,Chip8::timerCallback,nullptr);
 
@@ -23,7 +35,11 @@ try {
 	// standard execution loop
 	if (!Options::debug) {
 		while (isRunning) {
-			Chip8::loop();
+			// cycle timing - execute instructions frame by frame
+			if (Options::timing)
+				Chip8::loopFrame();
+			else
+				Chip8::loop();
 		}
 	/* debug mode - advance through program step by step, log
 	 * every executed instruction and current registers' states	*/
@@ -37,6 +53,10 @@ try {
 		}
 	}
 
+	// finish recording
+	Capture::stop();
+	Shared::stop();
+
 	// release resources and quit
 	SDL_DestroyTexture(Display::texture);
 	SDL_DestroyRenderer(Display::renderer);
@@ -48,6 +68,9 @@ try {
 } catch(std::runtime_error& e) {
 	std::cerr << e.what();
 
+	Capture::stop();
+	Shared::stop();
+
 	// release resources and quit
 	SDL_DestroyTexture(Display::texture);
 	SDL_DestroyRenderer(Display::renderer);
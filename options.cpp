@@ -6,11 +6,27 @@ std::string Options::filename;
 // debug mode flag
 bool Options::debug = false;
 
+// path to the capture file
+std::string Options::capture;
+
+// statistics export path and overlay flag
+std::string Options::stats;
+bool Options::overlay = false;
+
+// name of the shared memory region
+std::string Options::shared;
+
+// cycle timing flag
+bool Options::timing = false;
+
+// number of frames to run ahead
+int Options::runahead = 0;
+
 // parse and decode command line arguments
 void Options::parse(int argc, char* argv[])
 {
 	// range checking the number of arguments
-	if (argc < 2 || 3 < argc) 
+	if (argc < 2) 
 		throw std::runtime_error("Invalid number of arguments\n");
 
 	// first argument passed is always a path to the file to load
@@ -52,6 +68,38 @@ void Options::parse(int argc, char* argv[])
 				throw std::runtime_error
 				("Invalid resolution argument\n");
 			}
+		/* argument -c passed with a file name - record presented
+		 * frames to .y4m, .gif or .png (sequence) file	*/
+		} else if (arg.substr(0,2) == "-c" && arg.size() > 2) {
+			Options::capture = arg.substr(2);
+
+		/* argument -s - export statistics once per second as JSON
+		 * lines to stdout, or to the file named after it	*/
+		} else if (arg.substr(0,2) == "-s") {
+			Options::stats = arg.size() > 2 ? arg.substr(2) : "-";
+
+		// show statistics overlay
+		} else if (arg == "-o" || arg == "--overlay") {
+			Options::overlay = true;
+
+		/* argument -m passed with a name - publish frames and accept
+		 * key presses through shared memory /dev/shm/<name>	*/
+		} else if (arg.substr(0,2) == "-m" && arg.size() > 2) {
+			Options::shared = arg.substr(2);
+
+		/* cycle timing - instructions cost COSMAC VIP cycles and are
+		 * executed in batches of one frame			*/
+		} else if (arg == "-t" || arg == "--timing") {
+			Options::timing = true;
+
+		/* argument -a passed with a number of frames (1-8) - run-ahead
+		 * (needs frame based execution, so it enables cycle timing) */
+		} else if (arg.substr(0,2) == "-a" && arg.size() > 2) {
+			Options::runahead = std::stoi(arg.substr(2));
+			if (Options::runahead < 1 || 8 < Options::runahead)
+				throw std::runtime_error
+				("Invalid run-ahead argument\n");
+			Options::timing = true;
 		} else {
 			throw std::runtime_error("Unknown argument: " + arg + '\n');
 		}
@@ -0,0 +1,84 @@
+#include "chip8.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// mapped region (nullptr if not publishing)
+static Shared::Region* region = nullptr;
+static std::string region_name;
+
+// keys applied at the last check
+static uint16_t applied_keys = 0;
+
+// create and map the region /dev/shm/<name>
+void Shared::start(const std::string& name)
+{
+	region_name = '/' + name;
+
+	int fd = shm_open(region_name.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(Shared::Region)) < 0) {
+		if (fd >= 0) close(fd);
+		throw std::runtime_error("Error: can't create shared memory " + name + '\n');
+	}
+
+	void* memory = mmap(nullptr, sizeof(Shared::Region), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		throw std::runtime_error("Error: can't map shared memory " + name + '\n');
+
+	region = new (memory) Shared::Region {};
+	region->magic = Shared::magic;
+	region->version = Shared::version;
+}
+
+// publish the pixel buffer and registers (called for every presented frame)
+void Shared::publish()
+{
+	if (!region) return;
+
+	// odd sequence number - readers retry until writing is finished
+	uint32_t sequence = region->sequence.load(std::memory_order_relaxed);
+	region->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	++region->frame;
+	std::copy(registers, registers + 16, region->registers);
+	region->I = I;
+	region->pc = pc - storage;
+	region->delay_timer = delay_timer;
+	region->sound_timer = sound_timer;
+	std::copy(Display::buffer, Display::buffer + 2048, region->display);
+
+	region->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// apply keys pressed by external processes
+void Shared::pollKeys()
+{
+	if (!region) return;
+
+	uint16_t keys = region->keys.load(std::memory_order_relaxed);
+	if (keys == applied_keys) return;
+
+	for (int i = 0; i < 16; ++i) {
+		bool pressed = keys & (1 << i);
+		if (pressed == bool(applied_keys & (1 << i))) continue;
+
+		Keyboard::state[Keyboard::scancodes[i]] = pressed;
+		if (!pressed) Keyboard::release(Keyboard::scancodes[i]);
+	}
+
+	applied_keys = keys;
+	Idle::reset();
+}
+
+// unmap and remove the region
+void Shared::stop()
+{
+	if (!region) return;
+
+	munmap(region, sizeof(Shared::Region));
+	shm_unlink(region_name.c_str());
+	region = nullptr;
+}
@@ -0,0 +1,54 @@
+/* Layout of the shared memory region published by the emulator (-m option)
+ * in /dev/shm. The header doesn't depend on SDL, so external processes
+ * can include it on its own.
+ *
+ * Reading a consistent frame (seqlock):
+ *
+ *	uint32_t before, after;
+ *	do {
+ *		before = region->sequence.load(std::memory_order_acquire);
+ *		... copy fields ...
+ *		std::atomic_thread_fence(std::memory_order_acquire);
+ *		after = region->sequence.load(std::memory_order_relaxed);
+ *	} while (before != after || (before & 1));
+ *
+ * Pressing keys: store a bit mask of pressed CHIP-8 keys in keys
+ * (bit N - key N); the emulator applies changes before every instruction */
+#ifndef CHIP8_SHARED_H
+#define CHIP8_SHARED_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace Shared {
+	// "C8SH" and layout version
+	constexpr uint32_t magic = 0x48533843;
+	constexpr uint32_t version = 1;
+
+	struct Region {
+		uint32_t magic;
+		uint32_t version;
+		// odd while the emulator is writing the fields below
+		std::atomic<uint32_t> sequence;
+		// number of frames published
+		uint32_t frame;
+		/* machine state at the time of the frame (with run-ahead
+		 * the state and the pixel buffer are the real ones, not the
+		 * frame shown on screen a few frames ahead)		*/
+		uint8_t registers[16];
+		uint16_t I;
+		uint16_t pc;
+		uint8_t delay_timer;
+		uint8_t sound_timer;
+		// 64x32 pixel buffer (one byte per pixel, 0 or 1)
+		uint8_t display[2048];
+		// pressed keys, written by external processes
+		std::atomic<uint16_t> keys;
+	};
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free
+		&& std::atomic<uint16_t>::is_always_lock_free,
+		"shared memory atomics have to be lock free");
+}
+
+#endif
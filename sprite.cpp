@@ -0,0 +1,63 @@
+#include "batch.h"
+
+/* font and sprite drawing are shared by the emulator and the batch
+ * engine, so they don't depend on SDL			*/
+
+// font
+unsigned char font[90] ={ 0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
+		          0x20, 0x60, 0x20, 0x20, 0x70,   // 1
+		          0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2
+			  0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
+			  0x90, 0x90, 0xF0, 0x10, 0x10,   // 4
+			  0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
+			  0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
+			  0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
+			  0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
+			  0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
+			  0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
+			  0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
+			  0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
+			  0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
+			  0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
+			  0xF0, 0x80, 0xF0, 0x80, 0x80 }; // F
+
+/* draw sprite of given number of rows, read from memory at given
+ * address (wrapping at 4kb), into the pixel buffer; return collision */
+bool Display::blit(unsigned char* buffer, const unsigned char* memory,
+	const unsigned short& address, unsigned char X, unsigned char Y,
+	const int& rows)
+{
+	X %= 64;
+	Y %= 32;
+
+	bool collision = false;
+
+	// for every row of the sprite
+	for (int y_offset = 0; y_offset < rows; ++y_offset) {
+		// for every bit of the row
+		for (int x_offset = 0; x_offset < 8; ++x_offset) {
+			/* range checking bit and checking whether sprite
+			 	is being drawn on the same row */
+			if (PIXEL_INDEX(X, x_offset, Y, y_offset) < 2048 &&
+			((X+x_offset) < (64+64*Y+y_offset))) {
+				/* variable current_bit - pixel of the
+					sprite currently being drawn 	*/
+				bool current_bit = (memory[(address + y_offset) & 0xFFF]
+					>> 7-x_offset) & 0b00000001;
+
+				/*  checking if pixel collision occurs
+				       	   if so, set VF to 1 		*/
+				if (buffer[PIXEL_INDEX(X, x_offset, Y, y_offset)]
+				&& current_bit) {
+					collision = true;
+				}
+
+				// XOR bit with currently drawn pixel
+				buffer[PIXEL_INDEX(X, x_offset, Y, y_offset)]
+					^= current_bit;
+			} 
+		}
+	}
+
+	return collision;
+}
@@ -0,0 +1,184 @@
+#include "chip8.h"
+
+// statistics collection flags
+bool Stats::enabled = false;
+bool Stats::overlay = false;
+
+// counters of the current measurement window
+unsigned long Stats::instructions = 0;
+unsigned long Stats::events = 0;
+bool Stats::speculative = false;
+unsigned long Stats::speculative_instructions = 0;
+
+static uint64_t emulation_ticks = 0;
+static uint64_t draw_ticks = 0;
+static uint64_t window_start = 0;
+static uint64_t last_frame = 0;
+static std::vector<double> frame_times;
+
+// export destination (nullptr if not exporting)
+static std::ostream* output = nullptr;
+static std::ofstream ofs;
+static double elapsed = 0;
+
+// lines shown by the overlay (updated once per second)
+static std::vector<std::string> lines;
+
+// convert performance counter ticks to milliseconds
+static double milliseconds(const uint64_t& ticks)
+{
+	return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// value at the given percentile of sorted values
+static double percentile(const std::vector<double>& sorted, const double& p)
+{
+	if (sorted.empty()) return 0;
+	return sorted[std::min(sorted.size() - 1, std::size_t(p * sorted.size()))];
+}
+
+// format number with given digits after the decimal point
+static std::string format(const double& value, const int& precision)
+{
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(precision) << value;
+	return oss.str();
+}
+
+// start collecting statistics, export them to file ("-" for stdout)
+void Stats::start(const std::string& filename, const bool& show_overlay)
+{
+	if (filename == "-") {
+		output = &std::cout;
+	} else if (!filename.empty()) {
+		ofs.open(filename);
+		if (!ofs)
+			throw std::runtime_error("Error: can't open file " + filename + '\n');
+		output = &ofs;
+	}
+
+	Stats::overlay = show_overlay;
+	Stats::enabled = true;
+	window_start = SDL_GetPerformanceCounter();
+}
+
+// current performance counter value (0 if statistics are disabled)
+uint64_t Stats::now()
+{
+	return Stats::enabled ? SDL_GetPerformanceCounter() : 0;
+}
+
+// count instruction executed since start
+void Stats::emulation(const uint64_t& start)
+{
+	if (!Stats::enabled) return;
+	emulation_ticks += SDL_GetPerformanceCounter() - start;
+	if (Stats::speculative)
+		++Stats::speculative_instructions;
+	else
+		++Stats::instructions;
+}
+
+// count frame drawn since start, report once per second
+void Stats::draw(const uint64_t& start)
+{
+	if (!Stats::enabled) return;
+
+	uint64_t end = SDL_GetPerformanceCounter();
+	draw_ticks += end - start;
+	if (last_frame) frame_times.push_back(milliseconds(end - last_frame));
+	last_frame = end;
+
+	double window = milliseconds(end - window_start) / 1000.0;
+	if (window < 1.0) return;
+
+	std::vector<double> sorted = frame_times;
+	std::sort(sorted.begin(), sorted.end());
+
+	double ips = Stats::instructions / window;
+	double speculative_ips = Stats::speculative_instructions / window;
+	double fps = sorted.size() / window;
+	double draw = milliseconds(draw_ticks);
+	double emulation = milliseconds(emulation_ticks);
+	elapsed += window;
+
+	// one JSON object per line
+	if (output) {
+		*output << "{\"time\":" << format(elapsed, 3)
+			<< ",\"ips\":" << format(ips, 0)
+			<< ",\"speculative_ips\":" << format(speculative_ips, 0)
+			<< ",\"fps\":" << format(fps, 1)
+			<< ",\"frame_ms_p50\":" << format(percentile(sorted, 0.50), 3)
+			<< ",\"frame_ms_p95\":" << format(percentile(sorted, 0.95), 3)
+			<< ",\"frame_ms_p99\":" << format(percentile(sorted, 0.99), 3)
+			<< ",\"draw_ms\":" << format(draw, 3)
+			<< ",\"emulation_ms\":" << format(emulation, 3)
+			<< ",\"events\":" << Stats::events << "}\n";
+		output->flush();
+	}
+
+	if (Stats::overlay) {
+		lines = { "IPS " + format(ips, 0),
+			"FPS " + format(fps, 0) + " P50 " + format(percentile(sorted, 0.50), 1)
+				+ " P99 " + format(percentile(sorted, 0.99), 1),
+			"DRAW " + format(100 * draw / (window * 1000), 0) + "% EMU "
+				+ format(100 * emulation / (window * 1000), 0) + "%",
+			"EV " + std::to_string(Stats::events) };
+	}
+
+	// start next window
+	Stats::instructions = 0;
+	Stats::speculative_instructions = 0;
+	Stats::events = 0;
+	emulation_ticks = 0;
+	draw_ticks = 0;
+	frame_times.clear();
+	window_start = end;
+}
+
+/* 3x5 pixel font of characters used by the overlay (every row is 3 bits,
+ * most significant bit is the leftmost pixel)			*/
+static const std::string glyph_chars = "0123456789ACDEFIMPRSUVW%. ";
+static const unsigned char glyphs[][5] = {
+	{ 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 },	// 0-3
+	{ 5, 5, 7, 1, 1 }, { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 2, 2 },	// 4-7
+	{ 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 },						// 8-9
+	{ 2, 5, 7, 5, 5 }, { 7, 4, 4, 4, 7 }, { 6, 5, 5, 5, 6 }, { 7, 4, 6, 4, 7 },	// A C D E
+	{ 7, 4, 6, 4, 4 }, { 7, 2, 2, 2, 7 }, { 5, 7, 7, 5, 5 }, { 7, 5, 7, 4, 4 },	// F I M P
+	{ 6, 5, 6, 5, 5 }, { 7, 4, 7, 1, 7 }, { 5, 5, 5, 5, 7 }, { 5, 5, 5, 5, 2 },	// R S U V
+	{ 5, 5, 7, 7, 5 }, { 5, 1, 2, 4, 5 }, { 0, 0, 0, 0, 2 }, { 0, 0, 0, 0, 0 } };	// W % . space
+
+// draw the statistics overlay in the top left corner of the window
+void Stats::drawOverlay(SDL_Renderer* renderer)
+{
+	if (lines.empty()) return;
+
+	// size of the font pixel
+	constexpr int scale = 3;
+
+	std::size_t columns = 0;
+	for (const auto& line : lines) columns = std::max(columns, line.size());
+
+	// translucent background
+	SDL_Rect background { 0, 0, int(columns * 4 + 1) * scale, int(lines.size() * 6 + 1) * scale };
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+	SDL_RenderFillRect(renderer, &background);
+
+	std::vector<SDL_Rect> pixels;
+	for (std::size_t row = 0; row < lines.size(); ++row) {
+		for (std::size_t column = 0; column < lines[row].size(); ++column) {
+			std::size_t glyph = glyph_chars.find(lines[row][column]);
+			if (glyph == std::string::npos) continue;
+
+			for (int y = 0; y < 5; ++y)
+				for (int x = 0; x < 3; ++x)
+					if (glyphs[glyph][y] & (4 >> x))
+						pixels.push_back({ int(column * 4 + 1 + x) * scale,
+							int(row * 6 + 1 + y) * scale, scale, scale });
+		}
+	}
+
+	SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+	SDL_RenderFillRects(renderer, pixels.data(), pixels.size());
+}